@@ -0,0 +1,153 @@
+#!/usr/bin/python3 -u
+
+# 2022 eCTF
+# Bootloader Build Report
+# 0xDACC
+#
+# Compares the bootloader build variants (see VARIANT in the Makefile). Run through `make report`.
+# For each variant it lists the section sizes, how much of the 115KB flash slot the image uses and a
+# hash of the image, so two builds of the same tree can be checked for reproducibility, and its
+# worst-case stack depth and arena size (see stack_report.py).
+# If stats JSON files from `host_tools/stats --json-file` are given for some variants (captured on a
+# PROFILE=1 build right after the same operation), their per-phase timings are compared as well.
+
+import argparse
+import hashlib
+import json
+from pathlib import Path
+import subprocess
+
+from stack_report import stack_usage
+
+# Must match _BL_IMAGE_MAX in lib/tivaware/bootloader.ld
+BL_IMAGE_MAX = 0x1CC00
+
+SECTIONS = [".text", ".data", ".bss", ".stack"]
+
+
+def section_sizes(size_tool: str, axf: Path) -> dict:
+    out = subprocess.run(
+        [size_tool, "-A", str(axf)], capture_output=True, check=True
+    ).stdout.decode()
+
+    sizes = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[0] in SECTIONS:
+            sizes[fields[0]] = int(fields[1])
+    return sizes
+
+
+def size_table(size_tool: str, variants: list) -> list:
+    lines = [
+        "## Sizes",
+        "",
+        "| variant | .text | .data | .bss | .stack | flash used | of slot | image sha256 |",
+        "|---|---:|---:|---:|---:|---:|---:|---|",
+    ]
+    for name, axf in variants:
+        sizes = section_sizes(size_tool, axf)
+        flash = sizes.get(".text", 0) + sizes.get(".data", 0)
+        image = axf.with_suffix(".bin")
+        digest = hashlib.sha256(image.read_bytes()).hexdigest()[:16] if image.exists() else "-"
+        cols = [str(sizes.get(s, 0)) for s in SECTIONS]
+        lines.append(
+            f"| {name} | {' | '.join(cols)} | {flash} | {flash * 100 / BL_IMAGE_MAX:.1f}% | {digest} |"
+        )
+    return lines
+
+
+def stack_table(objdump: str, nm: str, variants: list) -> list:
+    lines = [
+        "",
+        "## Stack",
+        "",
+        "| variant | worst-case stack | _STACK_SIZE | headroom | arena | deepest path |",
+        "|---|---:|---:|---:|---:|---|",
+    ]
+    for name, axf in variants:
+        usage = stack_usage(axf, objdump, nm)
+        path = " -> ".join(f for f, _ in usage["path"])
+        lines.append(
+            f"| {name} | {usage['peak']} | {usage['stack_size']} | "
+            f"{usage['stack_size'] - usage['peak']} | {usage['arena']} | {path} |"
+        )
+    return lines
+
+
+def timing_table(timings: list) -> list:
+    if not timings:
+        return []
+
+    results = [(name, json.loads(path.read_text())) for name, path in timings]
+    phases = []
+    for _, stats in results:
+        for phase in stats["phases"]:
+            if phase not in phases:
+                phases.append(phase)
+
+    lines = [
+        "",
+        "## Timings (ms, count in brackets)",
+        "",
+        "| phase | " + " | ".join(name for name, _ in results) + " |",
+        "|---|" + "---:|" * len(results),
+    ]
+    for phase in phases:
+        cols = []
+        for _, stats in results:
+            entry = stats["phases"].get(phase)
+            if entry is None or not stats["clock_hz"]:
+                cols.append("-")
+                continue
+            ms = entry["cycles"] * 1000 / stats["clock_hz"]
+            cols.append(f"{ms:.2f} ({entry['count']})")
+        lines.append(f"| {phase} | " + " | ".join(cols) + " |")
+    return lines
+
+
+def split_pair(arg: str):
+    name, _, path = arg.partition("=")
+    if not path:
+        raise argparse.ArgumentTypeError(f"expected NAME=PATH, got {arg}")
+    return name, Path(path)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument(
+        "--size-tool", help="The binutils size program to use.", default="arm-none-eabi-size"
+    )
+    parser.add_argument(
+        "--objdump", help="The binutils objdump program to use.", default="arm-none-eabi-objdump"
+    )
+    parser.add_argument(
+        "--nm", help="The binutils nm program to use.", default="arm-none-eabi-nm"
+    )
+    parser.add_argument(
+        "--variant",
+        help="A variant and its linked image, as NAME=AXF.",
+        type=split_pair,
+        action="append",
+        required=True,
+    )
+    parser.add_argument(
+        "--timings",
+        help="A variant and a stats JSON file captured on it, as NAME=JSON.",
+        type=split_pair,
+        action="append",
+        default=[],
+    )
+
+    args = parser.parse_args()
+
+    lines = ["# Bootloader build report", ""]
+    lines += size_table(args.size_tool, args.variant)
+    lines += stack_table(args.objdump, args.nm, args.variant)
+    lines += timing_table(args.timings)
+    print("\n".join(lines))
+
+
+if __name__ == "__main__":
+    main()
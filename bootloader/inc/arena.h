@@ -0,0 +1,65 @@
+/**
+ * @file arena.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Statically planned scratch memory for the command handlers.
+ * @date 2022
+ *
+ * Only one command runs at a time, so the buffers and crypto contexts of the
+ * handlers share one union instead of each taking its own stack space. The
+ * page buffers of the data phase (load.c) sit beside it, as update and
+ * configure hold on to their scratch while the data is loaded. So does the
+ * payload of a framed command, as a batch runs its commands from there.
+ *
+ * `make stack` (or `make report`) shows the arena size next to the worst-case
+ * stack depth, which is what _STACK_SIZE in bootloader.ld is sized from.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdint.h>
+
+#include "aes.h"
+
+#include "digest.h"
+#include "frame.h"
+#include "load.h"
+
+// Release message buffer: 1024 + terminator, rounded up to whole flash words
+#define REL_MSG_BUFFER_SIZE     1028
+
+struct arena {
+    // Per command scratch
+    union {
+        struct {
+            uint8_t rel_msg[REL_MSG_BUFFER_SIZE] __attribute__((aligned(4)));
+            uint8_t vbuff[32];  // version frame, decrypted in place
+            uint8_t pbuff[16];  // password frames
+            struct AES_ctx aes;
+            struct digest_ctx digest;
+        } update;
+        struct {
+            uint8_t pbuff[16];
+            struct AES_ctx aes;
+        } configure;
+        struct {
+            uint8_t pbuff[16];
+        } readback;
+        struct {
+            struct digest_ctx ctx;
+            uint8_t out[DIGEST_MAX_SIZE];
+        } digest;
+    } cmd;
+
+    // Payload of a framed command, kept for the whole batch
+    uint8_t frame[FRAME_MAX_PAYLOAD];
+
+    // Page buffers of the data phase
+    struct load_page pages[LOAD_NUM_BUFFERS];
+};
+
+extern struct arena arena;
+
+#endif // ARENA_H
@@ -0,0 +1,76 @@
+/**
+ * @file digest.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief CRC32 and SHA-256 digests of flash contents.
+ * @date 2022
+ *
+ * The CRC32 is the driverlib Crc32(), finished so it matches zlib.crc32() on
+ * the host. It is quick but only catches accidents. The TM4C123 has no SHA
+ * hardware, so SHA-256 is done in software, which is several times slower.
+ *
+ * Digests are built up a piece at a time with digest_start(),
+ * digest_update() and digest_finish(), so they can be worked out while the
+ * data goes somewhere else.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdint.h>
+
+// Digest algorithms
+#define DIGEST_CRC32        0
+#define DIGEST_SHA256       1
+
+// Size of the largest digest
+#define DIGEST_MAX_SIZE     32
+
+struct digest_ctx {
+    uint32_t alg;           // DIGEST_*
+    uint32_t crc;
+    uint32_t state[8];      // SHA-256 hash value
+    uint8_t block[64];      // SHA-256 block being filled
+    uint32_t used;          // bytes in block
+    uint32_t total;         // bytes hashed so far
+};
+
+// Function Prototypes
+
+/**
+ * @brief Get the size of a digest.
+ *
+ * @param alg is the algorithm (DIGEST_*).
+ * @return the number of bytes digest_finish() writes, or 0 if alg is unknown.
+ */
+uint32_t digest_size(uint32_t alg);
+
+/**
+ * @brief Start a digest.
+ *
+ * @param ctx is the digest to start.
+ * @param alg is the algorithm (DIGEST_*), which must be known.
+ */
+void digest_start(struct digest_ctx *ctx, uint32_t alg);
+
+/**
+ * @brief Add data to a digest.
+ *
+ * @param ctx is the digest.
+ * @param data is the data to add.
+ * @param len is the number of bytes to add.
+ */
+void digest_update(struct digest_ctx *ctx, const uint8_t *data, uint32_t len);
+
+/**
+ * @brief Finish a digest.
+ *
+ * The CRC32 is written little endian, as zlib.crc32().to_bytes(4, "little").
+ *
+ * @param ctx is the digest.
+ * @param out is where to write the digest, digest_size() bytes.
+ */
+void digest_finish(struct digest_ctx *ctx, uint8_t *out);
+
+#endif // DIGEST_H
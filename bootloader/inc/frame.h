@@ -0,0 +1,90 @@
+/**
+ * @file frame.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Framed host commands.
+ * @date 2022
+ *
+ * Besides the legacy single byte commands the host can send framed ones.
+ * A frame starts with FRAME_SOF, which is not a command byte, so the command
+ * loop tells the two apart by the first byte:
+ *
+ *      u8  FRAME_SOF
+ *      u8  command, the legacy command byte or FRAME_CMD_BATCH
+ *      u16 payload length, at most FRAME_MAX_PAYLOAD
+ *      payload
+ *      u16 Fletcher-16 of the command, length and payload
+ *
+ * All little endian. The whole header of a command arrives in one frame, so
+ * the command needs no acks and no ghost byte workaround. The device answers
+ * with a frame of the same layout, with FRAME_RESPONSE set in the command,
+ * whose payload starts with:
+ *
+ *      u8  status, FRAME_OK or FRAME_BAD
+ *      u8  reason, TRACE_BAD_* (0 when OK)
+ *
+ * followed by the command's own data. The data phase of an update or
+ * configure and the data of a readback follow the response unframed, as in
+ * the legacy protocol.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdint.h>
+
+#define FRAME_SOF           0xA5
+#define FRAME_RESPONSE      0x80
+
+// Several commands in one frame, see handle_batch()
+#define FRAME_CMD_BATCH     'X'
+
+// Largest payload, enough for an update header with a full release message and a few more commands
+#define FRAME_MAX_PAYLOAD   1280
+
+// Function Prototypes
+
+/**
+ * @brief Receive the rest of a frame whose FRAME_SOF has been read.
+ *
+ * A frame that is too long is read to its end and thrown away.
+ *
+ * @param uart is the base address of the UART port to read from.
+ * @param cmd is where to store the command.
+ * @param buf is where to store the payload, FRAME_MAX_PAYLOAD bytes.
+ * @param len is where to store the payload length.
+ * @return 0 on success, or why the frame was rejected (TRACE_BAD_*).
+ */
+uint8_t frame_recv(uint32_t uart, uint8_t *cmd, uint8_t *buf, uint32_t *len);
+
+/**
+ * @brief Start a response frame.
+ *
+ * The caller writes len bytes of data with uart_write() and then calls
+ * frame_end().
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param cmd is the command answered.
+ * @param reason is 0 if the command succeeded, or why it failed (TRACE_BAD_*).
+ * @param len is the number of data bytes after the status and reason.
+ */
+void frame_begin(uint32_t uart, uint8_t cmd, uint8_t reason, uint32_t len);
+
+/**
+ * @brief Finish a response frame.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void frame_end(uint32_t uart);
+
+/**
+ * @brief Send a response frame without data.
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param cmd is the command answered.
+ * @param reason is 0 if the command succeeded, or why it failed (TRACE_BAD_*).
+ */
+void frame_reply(uint32_t uart, uint8_t cmd, uint8_t reason);
+
+#endif // FRAME_H
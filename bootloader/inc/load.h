@@ -0,0 +1,132 @@
+/**
+ * @file load.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Pipelined transfer of firmware and configuration data into flash.
+ * @date 2022
+ *
+ * The data phase of an update or configure runs as three cooperative tasks
+ * (see sched.h) that hand page buffers to each other through queues:
+ *
+ *      rx       checks the host's frames and splits them into pages
+ *      program  programs each page
+ *      tx       acknowledges each frame with FRAME_OK once all its pages are programmed
+ *
+ * Each stage only waits for its own input, so receiving the next page
+ * overlaps programming the last one. Every FRAME_OK frees the page buffers of
+ * a frame, so the host may keep as many frames unacknowledged as fit in
+ * LOAD_NUM_BUFFERS pages (credit based flow control) and stream without
+ * waiting for each frame.
+ *
+ * Frames are one page unless the host asked for bigger ones with the hello
+ * command (see load_set_frame_size()). Bigger frames mean fewer acks.
+ *
+ * The framed update and configure commands send checked frames. Each is,
+ * little endian:
+ *
+ *      u16 frame index within the transfer
+ *      frame size bytes of data, the last frame padded with 0xFF
+ *      u32 CRC32 of the index and data (as zlib.crc32())
+ *
+ * A frame that fails its CRC, or whose index is out of range, is answered
+ * with FRAME_BAD and the u16 number of the frame in the order the device
+ * received it, counting from 0 and including the bad ones. Its buffers are
+ * freed as for an ack, and the host sends only that frame again, so frames
+ * may arrive out of order. A frame whose index was already received is acked
+ * with FRAME_OK and dropped. A lost or extra byte cannot be recovered from, the
+ * frame deadline ends the command.
+ *
+ * The legacy single byte 'U' and 'C' commands send unchecked frames, as host
+ * tools from before the checked frames do: just the data, in order, with the
+ * last frame only as long as what is left.
+ *
+ * The UART FIFO only holds 16 bytes, about 1.4ms at 115200 baud. A page
+ * erase stalls the core for much longer, so the region is erased with
+ * load_erase() before the host is told to start. Programming is done a few
+ * words at a time so the rx task can keep draining the FIFO in between.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef LOAD_H
+#define LOAD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash.h"
+
+// Firmware update constants
+#define FRAME_OK 0x00
+#define FRAME_BAD 0x01
+
+// Number of page buffers in flight, which also sets the host's window of unacknowledged frames
+#define LOAD_NUM_BUFFERS    4
+
+// Largest frame, half the buffers so the next frame can arrive while one is programmed
+#define LOAD_MAX_FRAME_SIZE ((LOAD_NUM_BUFFERS / 2) * FLASH_PAGE_SIZE)
+
+// Most frames in one transfer, enough for the largest region in single page frames
+#define LOAD_MAX_FRAMES     128
+
+// Frame header and trailer
+#define LOAD_INDEX_SIZE     2
+#define LOAD_CRC_SIZE       4
+
+// Bytes load_report() sends
+#define LOAD_REPORT_SIZE    8
+
+// Words programmed before the program task lets the rx task drain the UART
+#define LOAD_WRITE_WORDS    8
+
+// A page on its way through the pipeline
+struct load_page {
+    uint8_t data[FLASH_PAGE_SIZE];
+    uint32_t addr;
+    uint32_t last;  // whether this is the last page of its frame
+};
+
+// Function Prototypes
+
+/**
+ * @brief Set the frame size of the next transfer.
+ *
+ * The size is rounded down to whole pages and limited to LOAD_MAX_FRAME_SIZE.
+ * It stays in effect until it is set again.
+ *
+ * @param size is the requested number of bytes per frame.
+ * @return the frame size that will be used.
+ */
+uint32_t load_set_frame_size(uint32_t size);
+
+/**
+ * @brief Erase the flash pages that load_data() will program.
+ *
+ * @param dst is the starting page address to store the data.
+ * @param size is the number of bytes to load.
+ */
+void load_erase(uint32_t dst, uint32_t size);
+
+/**
+ * @brief Read data from a UART interface and program to flash memory.
+ *
+ * The pages must have been erased with load_erase() first.
+ *
+ * @param interface is the base address of the UART interface to read from.
+ * @param dst is the starting page address to store the data.
+ * @param size is the number of bytes to load.
+ * @param checked is whether the frames carry an index and CRC32.
+ */
+void load_data(uint32_t interface, uint32_t dst, uint32_t size, bool checked);
+
+/**
+ * @brief Send the frame counters to the host and clear them.
+ *
+ * The counters are, little endian:
+ *      u32 data frames received
+ *      u32 data frames rejected with FRAME_BAD, and so sent again
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void load_report(uint32_t uart);
+
+#endif // LOAD_H
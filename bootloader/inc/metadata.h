@@ -0,0 +1,109 @@
+/**
+ * @file metadata.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Bootloader metadata record stored in EEPROM.
+ * @date 2022
+ *
+ * The firmware version, the firmware and configuration sizes, the boot
+ * flags and the firmware CRC live in a small EEPROM record instead of in flash metadata pages.
+ * EEPROM is word-writable, so updating one of these values never costs a
+ * 1KB page erase. The record is read once at startup and served from RAM.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef METADATA_H
+#define METADATA_H
+
+#include <stdint.h>
+
+// EEPROM storage layout
+/*
+ * Metadata record (follows the AES information):
+ *      Magic:    0x00000040 : 0x00000044 (4B)
+ *      Version:  0x00000044 : 0x00000048 (4B)
+ *      FW size:  0x00000048 : 0x0000004C (4B)
+ *      Cfg size: 0x0000004C : 0x00000050 (4B)
+ *      Flags:    0x00000050 : 0x00000054 (4B)
+ *      FW CRC:   0x00000054 : 0x00000058 (4B)
+ */
+#define METADATA_EEPROM_PTR     ((uint32_t)0x00000040)
+#define METADATA_MAGIC          ((uint32_t)0x4D455441) // "META"
+
+// Record fields, in words from the start of the record
+#define META_MAGIC              0
+#define META_FW_VERSION         1
+#define META_FW_SIZE            2
+#define META_CFG_SIZE           3
+#define META_FLAGS              4
+#define META_FW_CRC             5   // CRC32 of the firmware, valid with META_FLAG_FW_CRC
+#define META_NUM_FIELDS         6
+
+// Boot flags
+#define META_FLAG_FW_VALID      ((uint32_t)0x00000001)
+#define META_FLAG_CFG_VALID     ((uint32_t)0x00000002)
+#define META_FLAG_FW_CRC        ((uint32_t)0x00000004)  // firmware installed with its CRC recorded
+
+// Function Prototypes
+
+/**
+ * @brief Load the metadata record from EEPROM into the RAM cache.
+ *
+ * EEPROMInit() must have been called first.
+ *
+ * @return 0 if a valid record was loaded, or -1 if the EEPROM does not hold a
+ * record yet and metadata_format() must be called.
+ */
+int32_t metadata_init(void);
+
+/**
+ * @brief Write a fresh metadata record to EEPROM.
+ *
+ * The magic word is programmed last so a record that was only partially
+ * written is never accepted by metadata_init().
+ *
+ * @param version is the initial firmware version.
+ * @param fw_size is the initial firmware size.
+ * @param cfg_size is the initial configuration size.
+ * @param flags is the initial set of boot flags.
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_format(uint32_t version, uint32_t fw_size, uint32_t cfg_size, uint32_t flags);
+
+/**
+ * @brief Read a metadata field from the RAM cache.
+ *
+ * @param field is the field to read (META_*).
+ * @return the cached value of the field.
+ */
+uint32_t metadata_read(uint32_t field);
+
+/**
+ * @brief Write a metadata field through to EEPROM.
+ *
+ * Only the one word holding the field is programmed, and nothing is
+ * programmed at all if the value is unchanged.
+ *
+ * @param field is the field to write (META_*).
+ * @param value is the new value of the field.
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_write(uint32_t field, uint32_t value);
+
+/**
+ * @brief Set boot flags in the metadata record.
+ *
+ * @param flags is the set of flags to set (META_FLAG_*).
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_set_flags(uint32_t flags);
+
+/**
+ * @brief Clear boot flags in the metadata record.
+ *
+ * @param flags is the set of flags to clear (META_FLAG_*).
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_clear_flags(uint32_t flags);
+
+#endif // METADATA_H
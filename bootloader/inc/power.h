@@ -0,0 +1,66 @@
+/**
+ * @file power.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Low-power waits for the host UART and the flash controller.
+ * @date 2022
+ *
+ * The bootloader has no vector table of its own, so it cannot take
+ * interrupts. Interrupts stay masked in the core (PRIMASK) and the UART and
+ * flash controller interrupts are only enabled in the NVIC so that a pending
+ * one wakes the core from WFI. Nothing handles them, so power_sleep() clears
+ * them again after every wakeup.
+ *
+ * When the bootloader is built with POWER_STATS=1 a free-running timer
+ * measures how long the core spends asleep, which is added to the stats
+ * report (see profile_report()).
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+// Bytes sent by power_report()
+#define POWER_REPORT_SIZE   16
+
+// Function Prototypes
+
+/**
+ * @brief Set up the interrupts that wake the core from sleep.
+ *
+ * Must be called after uart_init().
+ */
+void power_init(void);
+
+/**
+ * @brief Sleep until the host UART receives data or a flash operation completes.
+ *
+ * Callers sleep in a loop until whatever they wait for is done, as the core
+ * also wakes for the other sources.
+ */
+void power_sleep(void);
+
+/**
+ * @brief Put the interrupt setup back the way power_init() found it.
+ *
+ * Called right before jumping to the firmware so it does not start with
+ * stray wakeup sources enabled or pending.
+ */
+void power_restore(void);
+
+/**
+ * @brief Send the sleep time counters to the host and clear them.
+ *
+ * The report is, little endian:
+ *      u64 timer ticks spent asleep
+ *      u64 timer ticks elapsed in total
+ *
+ * The timer runs at the system clock. Only sent in POWER_STATS builds.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void power_report(uint32_t uart);
+
+#endif // POWER_H
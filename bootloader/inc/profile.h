@@ -0,0 +1,116 @@
+/**
+ * @file profile.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Cycle counting for the phases of an update.
+ * @date 2022
+ *
+ * Phases are timed with the Cortex-M4 DWT cycle counter. QEMU does not model
+ * the DWT, so when the counter does not run the 24-bit SysTick counter is
+ * used instead, which is good for phases of up to 2^24 cycles each.
+ *
+ * The PROFILE_BEGIN/PROFILE_END probes only exist when the bootloader is
+ * built with PROFILE=1, otherwise they compile to nothing.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+// Profiled phases
+#define PROF_UART_READ      0
+#define PROF_AES            1
+#define PROF_FLASH_ERASE    2
+#define PROF_FLASH_WRITE    3
+#define PROF_BOOT_COPY      4   // includes PROF_BOOT_VERIFY
+#define PROF_BOOT_VERIFY    5   // counted per chunk of the boot copy
+#define PROF_NUM_PHASES     6
+
+// Timer sources
+#define PROF_SRC_DWT        0
+#define PROF_SRC_SYSTICK    1
+
+// Stats report format version
+#define PROF_REPORT_VERSION 2
+
+// Stats report flags
+#define PROF_REPORT_POWER   0x01    // sleep time counters follow the phases
+#define PROF_REPORT_FRAMES  0x02    // data frame counters follow, see load_report()
+
+// Probes open and close a block, so each PROFILE_BEGIN needs a matching
+// PROFILE_END at the same nesting level
+#ifdef PROFILE
+#define PROFILE_BEGIN(phase)    { uint32_t prof_start = profile_now()
+#define PROFILE_END(phase)      profile_record(phase, prof_start); }
+#else
+#define PROFILE_BEGIN(phase)
+#define PROFILE_END(phase)
+#endif
+
+// Function Prototypes
+
+/**
+ * @brief Start the cycle counter.
+ *
+ * Uses the DWT cycle counter if it runs, or SysTick if it does not.
+ */
+void profile_init(void);
+
+/**
+ * @brief Which timer the cycle counts come from.
+ *
+ * @return PROF_SRC_DWT or PROF_SRC_SYSTICK.
+ */
+uint8_t profile_source(void);
+
+/**
+ * @brief Read the cycle counter.
+ *
+ * @return the current cycle count. Only differences between two counts are
+ * meaningful, see profile_elapsed().
+ */
+uint32_t profile_now(void);
+
+/**
+ * @brief Cycles elapsed since an earlier profile_now().
+ *
+ * @param start is the earlier cycle count.
+ * @return the number of cycles since start, accounting for counter wrap.
+ */
+uint32_t profile_elapsed(uint32_t start);
+
+/**
+ * @brief Add one run of a phase to its totals.
+ *
+ * @param phase is the phase that ran (PROF_*).
+ * @param start is the cycle count when the phase started.
+ */
+void profile_record(uint32_t phase, uint32_t start);
+
+/**
+ * @brief Send the phase totals to the host and clear them.
+ *
+ * The report is, little endian:
+ *      u8  report format version
+ *      u8  number of phases N (0 if the probes are compiled out)
+ *      u8  timer source (PROF_SRC_*)
+ *      u8  flags (PROF_REPORT_*)
+ *      u32 system clock in Hz
+ *      N x { u32 count, u32 reserved, u64 cycles }
+ *      sleep time counters if PROF_REPORT_POWER is set, see power_report()
+ *      data frame counters if PROF_REPORT_FRAMES is set, see load_report()
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void profile_report(uint32_t uart);
+
+/**
+ * @brief Get the size of the report profile_report() sends.
+ *
+ * @return the number of bytes in the report.
+ */
+uint32_t profile_report_size(void);
+
+#endif // PROFILE_H
@@ -0,0 +1,69 @@
+/**
+ * @file queue.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Bounded FIFO queues for passing buffers between tasks.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define QUEUE_CAPACITY  4
+
+struct queue {
+    void *items[QUEUE_CAPACITY];
+    uint32_t head;      // oldest item
+    uint32_t count;     // number of items queued
+};
+
+// Function Prototypes
+
+/**
+ * @brief Empty a queue.
+ *
+ * @param q is the queue.
+ */
+void queue_init(struct queue *q);
+
+/**
+ * @brief Check if a queue is empty.
+ *
+ * @param q is the queue.
+ * @return true if there is nothing to take from the queue.
+ */
+bool queue_empty(struct queue *q);
+
+/**
+ * @brief Check if a queue is full.
+ *
+ * @param q is the queue.
+ * @return true if there is no room for another item.
+ */
+bool queue_full(struct queue *q);
+
+/**
+ * @brief Add an item to the back of a queue.
+ *
+ * The queue must not be full.
+ *
+ * @param q is the queue.
+ * @param item is the item to add.
+ */
+void queue_put(struct queue *q, void *item);
+
+/**
+ * @brief Take the item at the front of a queue.
+ *
+ * The queue must not be empty.
+ *
+ * @param q is the queue.
+ * @return the oldest item in the queue.
+ */
+void *queue_get(struct queue *q);
+
+#endif // QUEUE_H
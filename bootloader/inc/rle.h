@@ -0,0 +1,45 @@
+/**
+ * @file rle.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Run-length encoding of readback data.
+ * @date 2022
+ *
+ * Erased flash reads as 0xFF, so most of a readback of a sparse region is
+ * long runs of the same byte. The encoded stream is a list of tokens, each
+ * starting with a control byte c:
+ *
+ *      c < 0x80    literal: c + 1 bytes follow as they are
+ *      c >= 0x80   run: one more count byte n, then the byte value, which
+ *                  repeats (((c & 0x7F) << 8) | n) + 1 times
+ *
+ * Only runs of at least RLE_MIN_RUN bytes are encoded as runs, so the stream
+ * is at most 1/128 larger than the data, and a 64KB erased region shrinks to
+ * 6 bytes. The decoder knows how many bytes it asked for, so there is no end
+ * token.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef RLE_H
+#define RLE_H
+
+#include <stdint.h>
+
+#define RLE_RUN             0x80
+#define RLE_MAX_LITERAL     0x80
+#define RLE_MAX_RUN         0x8000
+#define RLE_MIN_RUN         4
+
+// Function Prototypes
+
+/**
+ * @brief Send data run-length encoded.
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param data is the data to send, read in place so it can be flash.
+ * @param size is the number of bytes of data.
+ * @return the number of bytes sent.
+ */
+uint32_t rle_send(uint32_t uart, const uint8_t *data, uint32_t size);
+
+#endif // RLE_H
@@ -0,0 +1,72 @@
+/**
+ * @file sched.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Cooperative scheduler for protothread-style tasks.
+ * @date 2022
+ *
+ * A task is a function that runs until it has to wait, returns to the
+ * scheduler, and carries on where it left off the next time it is called.
+ * The body of a task goes between TASK_BEGIN and TASK_END and waits with
+ * TASK_WAIT_UNTIL or TASK_YIELD. Local variables do not survive a wait, so
+ * anything a task needs across one is kept in a static instead, and waits
+ * cannot be placed inside a switch statement of the task's own.
+ *
+ * When every task is waiting the core sleeps until the UART, the flash
+ * controller or a deadline wakes it (see power.h and timeout.h).
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+// What a task returns to the scheduler
+#define TASK_WAITING    0   // blocked until something else happens
+#define TASK_YIELDED    1   // made progress, call again
+#define TASK_DONE       2   // finished, never called again
+
+struct task;
+typedef int32_t (*task_fn)(struct task *task);
+
+struct task {
+    task_fn fn;         // the task body
+    uint32_t resume;    // where to carry on, 0 to start from the top
+    int32_t state;      // what the task last returned (TASK_*)
+};
+
+#define TASK_BEGIN(t)   switch ((t)->resume) { case 0:
+
+#define TASK_WAIT_UNTIL(t, cond)                \
+    do {                                        \
+        (t)->resume = __LINE__;                 \
+        case __LINE__:                          \
+        if (!(cond)) {                          \
+            return TASK_WAITING;                \
+        }                                       \
+    } while (0)
+
+#define TASK_YIELD(t)                           \
+    do {                                        \
+        (t)->resume = __LINE__;                 \
+        return TASK_YIELDED;                    \
+        case __LINE__:;                         \
+    } while (0)
+
+#define TASK_END(t)     } (t)->resume = 0; return TASK_DONE
+
+// Function Prototypes
+
+/**
+ * @brief Run a set of tasks until all of them are done.
+ *
+ * Tasks are called round robin, in the order given. Every task starts from
+ * the top.
+ *
+ * @param tasks is the set of tasks to run.
+ * @param num is the number of tasks.
+ */
+void sched_run(struct task *tasks, uint32_t num);
+
+#endif // SCHED_H
@@ -0,0 +1,85 @@
+/**
+ * @file timeout.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Read deadlines that abort a command when the host goes quiet.
+ * @date 2022
+ *
+ * Each phase of a command gets a deadline, timed with a one-shot GPTM. If
+ * uart_readb() is still waiting when the deadline passes, the command is
+ * abandoned and control goes back to the command loop through timeout_env.
+ * The command loop waits for the next command without a deadline.
+ *
+ * The watchdog backs this up in case the bootloader hangs anywhere else: it
+ * is fed whenever the host UART moves data and resets the device after two
+ * periods without.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef TIMEOUT_H
+#define TIMEOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+// Deadline phases
+#define TIMEOUT_COMMAND         0   // everything a command reads before its data frames
+#define TIMEOUT_FRAME           1   // each data frame
+#define TIMEOUT_NUM_PHASES      2
+
+// Deadlines in ms, can be overridden from the Makefile
+#ifndef TIMEOUT_COMMAND_MS
+#define TIMEOUT_COMMAND_MS      10000
+#endif
+#ifndef TIMEOUT_FRAME_MS
+#define TIMEOUT_FRAME_MS        2000
+#endif
+#ifndef TIMEOUT_WATCHDOG_MS
+#define TIMEOUT_WATCHDOG_MS     5000
+#endif
+
+// Where a command that timed out returns to, set up by the command loop with setjmp()
+extern jmp_buf timeout_env;
+
+// Function Prototypes
+
+/**
+ * @brief Set up the deadline timer and start the watchdog.
+ */
+void timeout_init(void);
+
+/**
+ * @brief Start the deadline of a phase, replacing any earlier one.
+ *
+ * @param phase is the phase that starts (TIMEOUT_*).
+ */
+void timeout_start(uint32_t phase);
+
+/**
+ * @brief Stop the current deadline, if any.
+ */
+void timeout_stop(void);
+
+/**
+ * @brief Abandon the command if its deadline has passed.
+ *
+ * Does not return in that case, but jumps back to timeout_env. Otherwise it
+ * feeds the watchdog.
+ */
+void timeout_check(void);
+
+/**
+ * @brief Feed the watchdog.
+ */
+void timeout_feed(void);
+
+/**
+ * @brief Stop the deadline timer and the watchdog reset before booting the firmware.
+ *
+ * The watchdog itself cannot be stopped once it runs, so it is left counting
+ * with its reset and its interrupt disabled.
+ */
+void timeout_release(void);
+
+#endif // TIMEOUT_H
@@ -0,0 +1,84 @@
+/**
+ * @file trace.h
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Timestamped event trace kept in an SRAM ring.
+ * @date 2022
+ *
+ * The trace always runs and keeps the last TRACE_NUM_ENTRIES events, so a
+ * unit that stalls or rejects an update can be asked afterwards what it was
+ * doing. Timestamps come from the profiling cycle counter (see profile.h).
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_NUM_ENTRIES           64
+
+// Dump format version
+#define TRACE_DUMP_VERSION          1
+
+// Trace events
+#define TRACE_CMD_ENTER             1   // arg: command byte
+#define TRACE_CMD_EXIT              2   // arg: command byte
+#define TRACE_FRAME_RX              3   // arg: frame number within the transfer
+#define TRACE_PAGE_COMMIT           4   // arg: flash page number (address / FLASH_PAGE_SIZE)
+#define TRACE_FRAME_BAD             5   // arg: reason (TRACE_BAD_*)
+#define TRACE_TIMEOUT               6   // arg: deadline phase (TIMEOUT_*)
+
+// Reasons for sending FRAME_BAD
+#define TRACE_BAD_VERSION_PASSWORD  1   // version not signed with the password
+#define TRACE_BAD_VERSION_ROLLBACK  2   // version older than the installed one
+#define TRACE_BAD_FIRST_PASSWORD    3   // first password frame did not decrypt correctly
+#define TRACE_BAD_LAST_PASSWORD     4   // decrypted last password frame is wrong
+#define TRACE_BAD_READBACK_PASSWORD 5   // readback password is wrong
+#define TRACE_BAD_NO_FIRMWARE       6   // boot requested without a complete firmware
+#define TRACE_BAD_SIZE              7   // image does not fit its flash region
+#define TRACE_BAD_LENGTH            8   // frame or command payload has the wrong length
+#define TRACE_BAD_CHECKSUM          9   // frame checksum does not match
+#define TRACE_BAD_COMMAND           10  // unknown command, or not allowed there
+#define TRACE_BAD_REGION            11  // readback of an unknown region
+#define TRACE_BAD_CRC               12  // data frame failed its CRC or has a bad index
+#define TRACE_BAD_ALGORITHM         13  // unknown digest algorithm
+#define TRACE_BAD_DIGEST            14  // installed firmware does not match its digest
+#define TRACE_BAD_FLAGS             15  // unknown readback flags
+
+// Function Prototypes
+
+/**
+ * @brief Record an event in the trace.
+ *
+ * Once the ring is full the oldest event is overwritten.
+ *
+ * @param event is the event that happened (TRACE_*).
+ * @param arg is the event argument.
+ */
+void trace_event(uint16_t event, uint16_t arg);
+
+/**
+ * @brief Send the trace to the host, oldest event first.
+ *
+ * The dump is, little endian:
+ *      u8  dump format version
+ *      u8  timer source (PROF_SRC_*)
+ *      u16 number of events N
+ *      u32 system clock in Hz
+ *      N x { u32 timestamp, u16 event, u16 arg }
+ *
+ * The trace is left in place.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void trace_dump(uint32_t uart);
+
+/**
+ * @brief Get the size of the dump trace_dump() sends.
+ *
+ * @return the number of bytes in the dump.
+ */
+uint32_t trace_dump_size(void);
+
+#endif // TRACE_H
@@ -43,6 +43,9 @@ bool uart_avail(uint32_t uart);
 /**
  * @brief Read a byte from a UART interface.
  * 
+ * Sleeps until a byte arrives. Only the host UART wakes the core, see power.h.
+ * Does not return if the current deadline passes first, see timeout.h.
+ * 
  * @param uart is the base address of the UART port to read from.
  * @return the character read from the interface.
  */
@@ -89,4 +92,21 @@ void uart_writeb(uint32_t uart, uint8_t data);
  */
 uint32_t uart_write(uint32_t uart, uint8_t *buf, uint32_t len);
 
+
+/**
+ * @brief Start a running Fletcher-16 of the bytes read and written.
+ * 
+ * Every byte that goes through uart_readb() or uart_writeb() after this is
+ * added to it. Used to checksum frames, see frame.h.
+ */
+void uart_sum_start(void);
+
+
+/**
+ * @brief Get the running Fletcher-16 of the bytes read and written.
+ * 
+ * @return the checksum of the bytes since uart_sum_start().
+ */
+uint16_t uart_sum(void);
+
 #endif // UART_H
@@ -14,14 +14,28 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <setjmp.h>
+#include <string.h>
 
 #include "driverlib/interrupt.h"
 #include "driverlib/eeprom.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
 #include "inc/hw_types.h"
 #include "inc/hw_eeprom.h"
 #include "inc/hw_sysctl.h"
 
+#include "arena.h"
+#include "digest.h"
 #include "flash.h"
+#include "frame.h"
+#include "load.h"
+#include "metadata.h"
+#include "power.h"
+#include "profile.h"
+#include "rle.h"
+#include "timeout.h"
+#include "trace.h"
 #include "uart.h"
 
 #include "aes.h"
@@ -31,14 +45,17 @@
 
 /*
  * Firmware:
- *      Size:    0x0002B400 : 0x0002B404 (4B)
- *      Version: 0x0002B404 : 0x0002B408 (4B)
+ *      Size:    0x0002B400 : 0x0002B404 (4B, legacy - now kept in EEPROM)
+ *      Version: 0x0002B404 : 0x0002B408 (4B, legacy - now kept in EEPROM)
  *      Msg:     0x0002B408 : 0x0002BC00 (~2KB = 1KB + 1B + pad)
  *      Fw:      0x0002BC00 : 0x0002FC00 (16KB)
  *      FW pass: 0x0002FC00 : 0x0002FC0F (16B)
  * Configuration:
- *      Size:    0x0002FC0F : 0x00030000 (1KB = 4B + pad)
+ *      Size:    0x0002FC0F : 0x00030000 (1KB = 4B + pad, legacy - now kept in EEPROM)
  *      Cfg:     0x00030000 : 0x00040000 (64KB)
+ *
+ * The legacy size and version words are only read once, to carry them over
+ * into the EEPROM metadata record (see metadata.h) the first time it is created.
  */
 #define FIRMWARE_METADATA_PTR      ((uint32_t)(FLASH_START + 0x0002B400))
 #define FIRMWARE_SIZE_PTR          ((uint32_t)(FIRMWARE_METADATA_PTR + 0))
@@ -48,6 +65,7 @@
 
 #define FIRMWARE_STORAGE_PTR       ((uint32_t)(FIRMWARE_METADATA_PTR + (FLASH_PAGE_SIZE*2)))
 #define FIRMWARE_BOOT_PTR          ((uint32_t)0x20004000)
+#define FIRMWARE_MAX_SIZE          ((uint32_t)(FLASH_PAGE_SIZE*16))
 
 #define CONFIGURATION_METADATA_PTR ((uint32_t)(FIRMWARE_STORAGE_PTR + (FLASH_PAGE_SIZE*16)))
 // Note: This is 16 bytes offset from the reference design because we need to have the password for the firmware stored where this would be
@@ -56,10 +74,12 @@
 #define CONFIGURATION_SIZE_PTR     ((uint32_t)(CONFIGURATION_METADATA_PTR + 16))
 
 #define CONFIGURATION_STORAGE_PTR  ((uint32_t)(CONFIGURATION_METADATA_PTR + FLASH_PAGE_SIZE))
+#define CONFIGURATION_MAX_SIZE     ((uint32_t)(FLASH_END - CONFIGURATION_STORAGE_PTR))
 
-// Firmware update constants
-#define FRAME_OK 0x00
-#define FRAME_BAD 0x01
+// load_data() keeps track of LOAD_MAX_FRAMES frames, which must cover either region in single page frames
+typedef char load_max_frames_check[
+    (FIRMWARE_MAX_SIZE <= LOAD_MAX_FRAMES * FLASH_PAGE_SIZE) &&
+    (CONFIGURATION_MAX_SIZE <= LOAD_MAX_FRAMES * FLASH_PAGE_SIZE) ? 1 : -1];
 
 // EEPROM storage layout
 /*
@@ -67,6 +87,8 @@
  *      Key:     0x00000000 : 0x00000010 (16B) 
  *      IV:      0x00000010 : 0x00000020 (16B)
  *      Password 0x00000020 : 0x00000030 (16B)
+ * Metadata (see metadata.h):
+ *      Record:  0x00000040 : 0x00000058 (24B)
  */
 
 #define EEPROM_START_PTR        ((uint32_t)0x00000000)
@@ -74,6 +96,50 @@
 #define IV_OFFSET_PTR           ((uint32_t)EEPROM_START_PTR + 16)
 #define PASSWORD_OFFSET_PTR     ((uint32_t)EEPROM_START_PTR + 32)
 
+// Hello command, see handle_hello()
+#define HELLO_VERSION           1
+
+// Protocol features advertised by the hello command
+#define FEATURE_STATS           0x00000001  // 'S' command
+#define FEATURE_DIAGNOSTICS     0x00000002  // 'D' command
+#define FEATURE_WINDOW          0x00000004  // data frames acknowledged as credits
+#define FEATURE_PROFILE         0x00000008  // stats report has the phase counters
+#define FEATURE_POWER_STATS     0x00000010  // stats report has the sleep time
+#define FEATURE_FRAMES          0x00000020  // framed and batched commands, see frame.h
+#define FEATURE_DIGEST          0x00000040  // framed 'V' command, see frame_digest()
+#define FEATURE_READBACK_RLE    0x00000080  // run-length encoded readback, see frame_readback()
+#define FEATURE_DATA_CRC        0x00000100  // framed 'U' and 'C' data frames are checked, see load.h
+
+#ifdef PROFILE
+#define FEATURES_PROFILE        FEATURE_PROFILE
+#else
+#define FEATURES_PROFILE        0
+#endif
+#ifdef POWER_STATS
+#define FEATURES_POWER_STATS    FEATURE_POWER_STATS
+#else
+#define FEATURES_POWER_STATS    0
+#endif
+#define FEATURES                (FEATURE_STATS | FEATURE_DIAGNOSTICS | FEATURE_WINDOW | \
+                                 FEATURE_FRAMES | FEATURE_DIGEST | FEATURE_READBACK_RLE | \
+                                 FEATURE_DATA_CRC | FEATURES_PROFILE | FEATURES_POWER_STATS)
+
+// Digest recorded at install and checked at boot, META_FW_CRC holds 4 bytes
+#define BOOT_DIGEST             DIGEST_CRC32
+
+// Bytes digested between feeds of the watchdog
+#define DIGEST_CHUNK_SIZE       FLASH_PAGE_SIZE
+
+// Ranged readback flags
+#define READBACK_FLAG_RLE       0x01    // send the data run-length encoded, see rle.h
+#define READBACK_FLAGS          READBACK_FLAG_RLE
+
+// Most commands in one batch
+#define BATCH_MAX_ENTRIES       8
+
+// Reason given in the batch response for commands that did not run
+#define BATCH_SKIPPED           0xFF
+
 
 // 32 bit arrays for reading from eeprom
 uint32_t key32[4];
@@ -85,24 +151,142 @@ uint8_t key[16];
 uint8_t iv[16];
 uint8_t password[16];
 
+// Scratch memory of the command handlers, see arena.h
+struct arena arena;
+
+// The batch being run, see handle_batch()
+bool batch_active;
+uint8_t batch_num;
+uint8_t batch_ran;
+uint8_t batch_cmds[BATCH_MAX_ENTRIES];
+uint8_t batch_reasons[BATCH_MAX_ENTRIES];
+
 /**
- * @brief Boot the firmware.
+ * @brief Reject the current frame, recording the reason in the trace.
+ *
+ * @param reason is why the frame was rejected (TRACE_BAD_*).
  */
-void handle_boot(void)
+void frame_bad(uint16_t reason)
+{
+    trace_event(TRACE_FRAME_BAD, reason);
+    uart_writeb(HOST_UART, FRAME_BAD);
+}
+
+/**
+ * @brief Refuse a framed command, recording the reason in the trace.
+ *
+ * @param cmd is the command refused.
+ * @param reason is why it was refused (TRACE_BAD_*).
+ * @return the reason.
+ */
+uint8_t frame_refuse(uint8_t cmd, uint8_t reason)
+{
+    trace_event(TRACE_FRAME_BAD, reason);
+    frame_reply(HOST_UART, cmd, reason);
+    return reason;
+}
+
+/**
+ * @brief Work out the digest of a range of flash.
+ *
+ * @param ctx is the digest, started by the caller.
+ * @param addr is the address of the range.
+ * @param size is the number of bytes in the range.
+ */
+void digest_flash(struct digest_ctx *ctx, uint32_t addr, uint32_t size)
+{
+    uint32_t n;
+
+    while (size > 0) {
+        n = size > DIGEST_CHUNK_SIZE ? DIGEST_CHUNK_SIZE : size;
+        digest_update(ctx, (uint8_t *)addr, n);
+        addr += n;
+        size -= n;
+
+        // A SHA-256 of the whole configuration region takes a while
+        timeout_feed();
+    }
+}
+
+/**
+ * @brief Copy the installed firmware to RAM for booting, checking it on the way.
+ *
+ * The digest of each chunk is worked out from the RAM copy right after it is
+ * made, so checking costs no extra pass over flash. Firmware installed before
+ * the bootloader recorded digests is booted unchecked.
+ *
+ * @return 0 if the copy matches the digest recorded at install, or
+ * TRACE_BAD_DIGEST.
+ */
+uint8_t boot_copy(void)
 {
+    struct digest_ctx *ctx = &arena.cmd.digest.ctx;
     uint32_t size;
+    uint32_t n;
     uint32_t i = 0;
+    uint32_t crc;
+
+    // Find the metadata
+    size = metadata_read(META_FW_SIZE);
+
+    // move firmware to boot, but dont include the password
+    digest_start(ctx, BOOT_DIGEST);
+    PROFILE_BEGIN(PROF_BOOT_COPY);
+    while (i < size) {
+        n = size - i > DIGEST_CHUNK_SIZE ? DIGEST_CHUNK_SIZE : size - i;
+        memcpy((uint8_t *)(FIRMWARE_BOOT_PTR + i), (uint8_t *)(FIRMWARE_STORAGE_PTR + i), n);
+
+        PROFILE_BEGIN(PROF_BOOT_VERIFY);
+        digest_update(ctx, (uint8_t *)(FIRMWARE_BOOT_PTR + i), n);
+        PROFILE_END(PROF_BOOT_VERIFY);
+        i += n;
+    }
+    PROFILE_END(PROF_BOOT_COPY);
+    digest_finish(ctx, arena.cmd.digest.out);
+
+    if (!(metadata_read(META_FLAGS) & META_FLAG_FW_CRC)) {
+        return 0;
+    }
+    memcpy(&crc, arena.cmd.digest.out, sizeof(crc));
+    if (crc != metadata_read(META_FW_CRC)) {
+        return TRACE_BAD_DIGEST;
+    }
+    return 0;
+}
+
+/**
+ * @brief Execute the firmware copied by boot_copy(). Does not return.
+ */
+void boot_jump(void)
+{
+    timeout_release();
+    power_restore();
+    void (*firmware)(void) = (void (*)(void))(FIRMWARE_BOOT_PTR + 1);
+    firmware();
+}
+
+/**
+ * @brief Boot the firmware.
+ */
+void handle_boot(void)
+{
     uint8_t *rel_msg;
+    uint8_t reason;
 
     // Acknowledge the host
     uart_writeb(HOST_UART, 'B');    
 
-    // Find the metadata
-    size = *((uint32_t *)FIRMWARE_SIZE_PTR);
+    // Refuse to boot if there is no complete firmware install
+    if (!(metadata_read(META_FLAGS) & META_FLAG_FW_VALID)) {
+        frame_bad(TRACE_BAD_NO_FIRMWARE);
+        return;
+    }
 
-    // move firmware to boot, but dont include the password
-    for (i = 0; i < size; i++) {
-        *((uint8_t *)(FIRMWARE_BOOT_PTR + i)) = *((uint8_t *)(FIRMWARE_STORAGE_PTR + i));
+    // Refuse to boot firmware that has changed since it was installed
+    reason = boot_copy();
+    if (reason != 0) {
+        frame_bad(reason);
+        return;
     }
 
     // acknowledge host
@@ -117,67 +301,50 @@ void handle_boot(void)
     uart_writeb(HOST_UART, '\0'); // Null terminator...
 
     // Execute the firmware
-    void (*firmware)(void) = (void (*)(void))(FIRMWARE_BOOT_PTR + 1);
-    firmware();
+    boot_jump();
 }
 
 
 /**
- * @brief Send the firmware data over the host interface. The host will decrypt it
+ * @brief Find the flash region a readback or digest refers to.
+ *
+ * @param region is the region, 'F' for firmware or 'C' for configuration.
+ * @param base is where to store the address of the region.
+ * @param max_size is where to store the size of the region.
+ * @return 0 if the region is known, or TRACE_BAD_REGION.
  */
-void handle_readback(void)
+uint8_t region_bounds(uint8_t region, uint32_t *base, uint32_t *max_size)
 {
-    uint8_t region;
-    uint8_t *address;
-    uint32_t size = 0;
-    uint8_t pbuff[16];
-    
-    // Acknowledge the host
-    uart_writeb(HOST_UART, 'R');
-
-    // Read the password supplied by the host
-    uart_read(HOST_UART, pbuff, 16);
-
-    //Acknowledge
-    uart_writeb(HOST_UART, FRAME_OK);
-
-    // Check if the password supplied is the correct one
-    for(int i = 0; i < 16; i++){
-        if(pbuff[i] != password[i]){
-            //incorrect or invalid password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
-        }
+    if (region == 'F') {
+        *base = FIRMWARE_STORAGE_PTR;
+        *max_size = FIRMWARE_MAX_SIZE;
+    } else if (region == 'C') {
+        *base = CONFIGURATION_STORAGE_PTR;
+        *max_size = CONFIGURATION_MAX_SIZE;
+    } else {
+        return TRACE_BAD_REGION;
     }
+    return 0;
+}
 
-    //Acknowledge
-    uart_writeb(HOST_UART, FRAME_OK);
-
-    // Receive region identifier
-    region = (uint32_t)uart_readb(HOST_UART);
+/**
+ * @brief Send the data of a readback.
+ *
+ * @param region is the region to read, 'F' for firmware or 'C' for configuration.
+ * @param size is the number of bytes the host asked for.
+ */
+void readback_send(uint8_t region, uint32_t size)
+{
+    uint8_t *address;
 
-    // Set base address for readback
     if (region == 'F') {
         // Set the base address for the readback
         address = (uint8_t *)FIRMWARE_STORAGE_PTR;
-        // Acknowledge the host
-        uart_writeb(HOST_UART, 'F');
-    } else if (region == 'C') {
+    } else {
         // Set the base address for the readback
         address = (uint8_t *)CONFIGURATION_STORAGE_PTR;
-        // Acknowledge the host
-        uart_writeb(HOST_UART, 'C');
-    } else {
-        uart_writeb(HOST_UART, 'Q');
-        return;
     }
 
-    // Receive the size to send back to the host
-    size = ((uint32_t)uart_readb(HOST_UART)) << 24;
-    size |= ((uint32_t)uart_readb(HOST_UART)) << 16;
-    size |= ((uint32_t)uart_readb(HOST_UART)) << 8;
-    size |= (uint32_t)uart_readb(HOST_UART);
-
     // Now we want to protect against readback overreach, meaning that we overreach what we really should be reading back. You asked for Fw, were ONLY going to give you FW
     // Read out the data
 
@@ -210,151 +377,183 @@ void handle_readback(void)
 }
 
 /**
- * @brief Read data from a UART interface and program to flash memory.
- * 
- * @param interface is the base address of the UART interface to read from.
- * @param dst is the starting page address to store the data.
- * @param size is the number of bytes to load.
+ * @brief Send the firmware data over the host interface. The host will decrypt it
  */
-void load_data(uint32_t interface, uint32_t dst, uint32_t size)
+void handle_readback(void)
 {
-    int i;
-    uint32_t frame_size;
-    uint8_t page_buffer[FLASH_PAGE_SIZE];
-
-    while(size > 0) {
-        // calculate frame size
-        frame_size = size > FLASH_PAGE_SIZE ? FLASH_PAGE_SIZE : size;
-        // read frame into buffer
-        uart_read(HOST_UART, page_buffer, frame_size);
-        // pad buffer if frame is smaller than the page
-        for(i = frame_size; i < FLASH_PAGE_SIZE; i++) {
-            page_buffer[i] = 0xFF;
+    uint8_t region;
+    uint32_t size = 0;
+    uint8_t *pbuff = arena.cmd.readback.pbuff;
+    
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'R');
+
+    // Read the password supplied by the host
+    uart_read(HOST_UART, pbuff, 16);
+
+    //Acknowledge
+    uart_writeb(HOST_UART, FRAME_OK);
+
+    // Check if the password supplied is the correct one
+    for(int i = 0; i < 16; i++){
+        if(pbuff[i] != password[i]){
+            //incorrect or invalid password
+            frame_bad(TRACE_BAD_READBACK_PASSWORD);
+            return;
         }
-        // clear flash page
-        flash_erase_page(dst);
-        // write flash page
-        flash_write((uint32_t *)page_buffer, dst, FLASH_PAGE_SIZE >> 2);
-        // next page and decrease size
-        dst += FLASH_PAGE_SIZE;
-        size -= frame_size;
-        // send frame ok
-        uart_writeb(HOST_UART, FRAME_OK);
     }
-}
 
-/**
- * @brief Update the firmware.
- */
-void handle_update(void)
-{
-    uint8_t vbuff[32];  // 8 bit array that will hold the version for decryption
-    uint8_t pbuff[16];
-    uint32_t version = 0;
-    uint32_t size = 0;
-    uint32_t rel_msg_size = 0;
-    uint8_t rel_msg[1025]; // 1024 + terminator
+    //Acknowledge
+    uart_writeb(HOST_UART, FRAME_OK);
 
-    // Acknowledge the host
-    uart_writeb(HOST_UART, 'U');
-    // We found the ghost byte would be wacky right about here sometimes, so we decided to add this extra thing here
-    uart_writeb(HOST_UART, 'G');
+    // Receive region identifier
+    region = (uint32_t)uart_readb(HOST_UART);
 
-    // Receive version, store in buffer for decryption
-    uart_read(HOST_UART, vbuff, 32);
-    // Acknowledge
-    uart_writeb(HOST_UART, FRAME_OK);
+    // Set base address for readback
+    if ((region == 'F') || (region == 'C')) {
+        // Acknowledge the host
+        uart_writeb(HOST_UART, region);
+    } else {
+        uart_writeb(HOST_UART, 'Q');
+        return;
+    }
 
-    // Receive size
+    // Receive the size to send back to the host
     size = ((uint32_t)uart_readb(HOST_UART)) << 24;
     size |= ((uint32_t)uart_readb(HOST_UART)) << 16;
     size |= ((uint32_t)uart_readb(HOST_UART)) << 8;
     size |= (uint32_t)uart_readb(HOST_UART);
 
-    // get the size of the release message
-    rel_msg_size = uart_readline(HOST_UART, rel_msg) + 1; // Include terminator
+    readback_send(region, size);
+}
+
+/**
+ * @brief Decrypt the first password frame and check it.
+ *
+ * @param pbuff is the encrypted frame, decrypted in place.
+ * @param ctx is the AES context to use.
+ * @return 0 if it is the password, or TRACE_BAD_FIRST_PASSWORD.
+ */
+uint8_t check_first_password(uint8_t *pbuff, struct AES_ctx *ctx)
+{
+    // Decrypt password
+    AES_init_ctx_iv(ctx, key, iv);
+    PROFILE_BEGIN(PROF_AES);
+    AES_CBC_decrypt_buffer(ctx, pbuff, 16);
+    PROFILE_END(PROF_AES);
+
+    // check password
+    for(int i = 0; i<16; i++){
+       if (password[i] != pbuff[i]){
+            // incorrect password
+            return TRACE_BAD_FIRST_PASSWORD;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Decrypt the version frame of an update and check it.
+ *
+ * @param version is where to store the version number.
+ * @return 0 if the version may be installed, or why not (TRACE_BAD_*).
+ */
+uint8_t update_check_version(uint32_t *version)
+{
+    uint8_t *vbuff = arena.cmd.update.vbuff;
 
     // Decrypt the version number
-    struct AES_ctx version_ctx;
-    AES_init_ctx_iv(&version_ctx, key, iv);
-    AES_CBC_decrypt_buffer(&version_ctx, vbuff, 32);
+    struct AES_ctx *version_ctx = &arena.cmd.update.aes;
+    AES_init_ctx_iv(version_ctx, key, iv);
+    PROFILE_BEGIN(PROF_AES);
+    AES_CBC_decrypt_buffer(version_ctx, vbuff, 32);
+    PROFILE_END(PROF_AES);
 
     // Check for password
     for(int i = 0; i<16; i++){
        if (password[i] != vbuff[16+i]){
             // Version Number is not signed with the correct password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
+            return TRACE_BAD_VERSION_PASSWORD;
         }
     }
 
     // If it not an acceptable number then return and quit
-    if ((version != 0) && (version < *(uint32_t *)FIRMWARE_VERSION_PTR)) {
+    if ((*version != 0) && (*version < metadata_read(META_FW_VERSION))) {
         // Version is not acceptable
-        uart_writeb(HOST_UART, FRAME_BAD);
-        return;
+        return TRACE_BAD_VERSION_ROLLBACK;
     }
 
     // since the version can actually take up to 16 bits we need to turn the two 8 bit bytes into one larger byte
-    version = vbuff[0] << 8;
-    version |= vbuff[1];
+    *version = vbuff[0] << 8;
+    *version |= vbuff[1];
 
-    //Acknowledge
-    uart_writeb(HOST_UART, FRAME_OK);
+    return 0;
+}
 
-    // get first password frame
-    uart_read(HOST_UART, pbuff, 16);
+/**
+ * @brief Finish an update once the key and IV have been sent: check the last
+ * password, then load the firmware and its release message.
+ *
+ * @param size is the size of the image, including both password frames.
+ * @param version is the version number to record.
+ * @param rel_msg_size is the size of the release message in the arena, including its terminator.
+ * @param checked is whether the data frames carry an index and CRC32, see load_data().
+ * @return 0 if the firmware was installed, or why not (TRACE_BAD_*).
+ */
+uint8_t update_finish(uint32_t size, uint32_t version, uint32_t rel_msg_size, bool checked)
+{
+    uint8_t *pbuff = arena.cmd.update.pbuff;
+    uint8_t *rel_msg = arena.cmd.update.rel_msg;
+    uint32_t crc;
 
-    // Decrypt password
-    struct AES_ctx firstpass_ctx;
-    AES_init_ctx_iv(&firstpass_ctx, key, iv);
-    AES_CBC_decrypt_buffer(&firstpass_ctx, pbuff, 16);
+    // recieve the decrypted ending password and double check
+    uart_read(HOST_UART, pbuff, 16);
 
     // check password
     for(int i = 0; i<16; i++){
        if (password[i] != pbuff[i]){
-            // incorrect password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
+           // wrong password
+            frame_bad(TRACE_BAD_LAST_PASSWORD);
+            return TRACE_BAD_LAST_PASSWORD;
         }
     }
 
-    // acknowledge host
-    uart_writeb(HOST_UART, FRAME_OK);
+    // The firmware must fit its region, as the whole region is erased up front
+    if ((size < 32) || (size - 32 > FIRMWARE_MAX_SIZE)) {
+        frame_bad(TRACE_BAD_SIZE);
+        return TRACE_BAD_SIZE;
+    }
 
-    // send crypto for use by host
-    uart_write(HOST_UART, key, 16);
-    uart_write(HOST_UART, iv, 16);
+    // The old firmware is gone from here on, so it must not be booted until the new one is complete
+    metadata_clear_flags(META_FLAG_FW_VALID | META_FLAG_FW_CRC);
 
-    // recieve the decrypted ending password and double check
-    uart_read(HOST_UART, pbuff, 16);
+    // Clear firmware metadata (release message)
+    flash_erase_page(FIRMWARE_METADATA_PTR);
 
-    // check password
-    for(int i = 0; i<16; i++){
-       if (password[i] != pbuff[i]){
-           // wrong password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
-        }
-    }
+    // Erase before the host may start sending, it streams the data without waiting for each page
+    load_erase(FIRMWARE_STORAGE_PTR, size-32);
 
     // acknowledge host
     uart_writeb(HOST_UART, FRAME_OK);
 
-    // Clear firmware metadata
-    flash_erase_page(FIRMWARE_METADATA_PTR);
-
     //load firmware
-    load_data(HOST_UART, FIRMWARE_STORAGE_PTR, size-32);
+    load_data(HOST_UART, FIRMWARE_STORAGE_PTR, size-32, checked);
 
     // Since 32 bytes of our size measurement is password data we subtract 32 from our size count
     size -= 32;
 
-    flash_write_word(size, FIRMWARE_SIZE_PTR);
+    metadata_write(META_FW_SIZE, size);
+
+    // Record the digest of what actually went into flash, for boot_copy() to check
+    digest_start(&arena.cmd.update.digest, BOOT_DIGEST);
+    digest_flash(&arena.cmd.update.digest, FIRMWARE_STORAGE_PTR, size);
+    digest_finish(&arena.cmd.update.digest, (uint8_t *)&crc);
+    metadata_write(META_FW_CRC, crc);
 
     // Only save new version if it is not 0
     if(version != 0){
-        flash_write_word(version, FIRMWARE_VERSION_PTR);
+        metadata_write(META_FW_VERSION, version);
     }
     
     //write message
@@ -384,48 +583,62 @@ void handle_update(void)
     }
     flash_write((uint32_t *)rel_msg_read_ptr, rel_msg_write_ptr, rem_bytes >> 2);
 
+    // Firmware is complete and may be booted
+    metadata_set_flags(META_FLAG_FW_VALID | META_FLAG_FW_CRC);
+
     // acknowledge host
     uart_writeb(HOST_UART, FRAME_OK);
+    return 0;
 }
 
 /**
- * @brief Load configuration data.
+ * @brief Update the firmware.
  */
-void handle_configure(void)
+void handle_update(void)
 {
+    uint8_t *vbuff = arena.cmd.update.vbuff;  // 8 bit array that will hold the version for decryption
+    uint8_t *pbuff = arena.cmd.update.pbuff;
+    uint32_t version = 0;
     uint32_t size = 0;
-    uint8_t pbuff[16];
+    uint32_t rel_msg_size = 0;
+    uint8_t *rel_msg = arena.cmd.update.rel_msg; // 1024 + terminator
+    uint8_t reason;
 
     // Acknowledge the host
-    uart_writeb(HOST_UART, 'C');
-    
-    // Catch second byte
+    uart_writeb(HOST_UART, 'U');
+    // We found the ghost byte would be wacky right about here sometimes, so we decided to add this extra thing here
     uart_writeb(HOST_UART, 'G');
 
+    // Receive version, store in buffer for decryption
+    uart_read(HOST_UART, vbuff, 32);
+    // Acknowledge
+    uart_writeb(HOST_UART, FRAME_OK);
+
     // Receive size
-    size = (((uint32_t)uart_readb(HOST_UART)) << 24);
-    size |= (((uint32_t)uart_readb(HOST_UART)) << 16);
-    size |= (((uint32_t)uart_readb(HOST_UART)) << 8);
-    size |= ((uint32_t)uart_readb(HOST_UART));
+    size = ((uint32_t)uart_readb(HOST_UART)) << 24;
+    size |= ((uint32_t)uart_readb(HOST_UART)) << 16;
+    size |= ((uint32_t)uart_readb(HOST_UART)) << 8;
+    size |= (uint32_t)uart_readb(HOST_UART);
 
-    // Acknowledge the host
+    // get the size of the release message
+    rel_msg_size = uart_readline(HOST_UART, rel_msg) + 1; // Include terminator
+
+    reason = update_check_version(&version);
+    if (reason != 0) {
+        frame_bad(reason);
+        return;
+    }
+
+    //Acknowledge
     uart_writeb(HOST_UART, FRAME_OK);
 
     // get first password frame
     uart_read(HOST_UART, pbuff, 16);
 
-    // Decrypt password
-    struct AES_ctx firstpass_ctx;
-    AES_init_ctx_iv(&firstpass_ctx, key, iv);
-    AES_CBC_decrypt_buffer(&firstpass_ctx, pbuff, 16);
-
-    // check password
-    for(int i = 0; i<16; i++){
-       if (password[i] != pbuff[i]){
-            // incorrect password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
-        }
+    reason = check_first_password(pbuff, &arena.cmd.update.aes);
+    if (reason != 0) {
+        frame_bad(reason);
+        return;
     }
 
     // acknowledge host
@@ -435,40 +648,677 @@ void handle_configure(void)
     uart_write(HOST_UART, key, 16);
     uart_write(HOST_UART, iv, 16);
 
-    // recieve the decrypted ending password and double check
-    uart_read(HOST_UART, pbuff, 16);
+    // Older host tools send the data unchecked
+    update_finish(size, version, rel_msg_size, false);
+}
 
-    // check password
+/**
+ * @brief Finish a configure once the key and IV have been sent: check the
+ * last password, then load the configuration.
+ *
+ * @param size is the size of the image, including both password frames.
+ * @param checked is whether the data frames carry an index and CRC32, see load_data().
+ * @return 0 if the configuration was installed, or why not (TRACE_BAD_*).
+ */
+uint8_t configure_finish(uint32_t size, bool checked)
+{
+    uint8_t *pbuff = arena.cmd.configure.pbuff;
+
+    // recieve the decrypted ending password and double check
+    uart_read(HOST_UART, pbuff, 16);
+
+    // check password
     for(int i = 0; i<16; i++){
        if (password[i] != pbuff[i]){
            // wrong password
-            uart_writeb(HOST_UART, FRAME_BAD);
-            return;
+            frame_bad(TRACE_BAD_LAST_PASSWORD);
+            return TRACE_BAD_LAST_PASSWORD;
         }
     }
 
+    // The configuration must fit its region, as the whole region is erased up front
+    if ((size < 32) || (size - 32 > CONFIGURATION_MAX_SIZE)) {
+        frame_bad(TRACE_BAD_SIZE);
+        return TRACE_BAD_SIZE;
+    }
+
+    // The old configuration is gone from here on
+    metadata_clear_flags(META_FLAG_CFG_VALID);
+
+    // Erase before the host may start sending, it streams the data without waiting for each page
+    load_erase(CONFIGURATION_STORAGE_PTR, size-32);
+
     // acknowledge host
     uart_writeb(HOST_UART, FRAME_OK);
 
-    // Clear firmware metadata
-    flash_erase_page(CONFIGURATION_METADATA_PTR);
-
     //load firmware
-    load_data(HOST_UART, CONFIGURATION_STORAGE_PTR, size-32);
+    load_data(HOST_UART, CONFIGURATION_STORAGE_PTR, size-32, checked);
 
     // Since 32 bytes of our config is password data, we need to remove that from the total count
     size -= 32;
 
     // and after all that we will know the true size of the config, so we can now write it
-    flash_write_word(size, CONFIGURATION_SIZE_PTR);
+    metadata_write(META_CFG_SIZE, size);
+    metadata_set_flags(META_FLAG_CFG_VALID);
 
     // acknowledge
     uart_writeb(HOST_UART, FRAME_OK);
+    return 0;
+}
+
+/**
+ * @brief Load configuration data.
+ */
+void handle_configure(void)
+{
+    uint32_t size = 0;
+    uint8_t *pbuff = arena.cmd.configure.pbuff;
+    uint8_t reason;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'C');
+    
+    // Catch second byte
+    uart_writeb(HOST_UART, 'G');
+
+    // Receive size
+    size = (((uint32_t)uart_readb(HOST_UART)) << 24);
+    size |= (((uint32_t)uart_readb(HOST_UART)) << 16);
+    size |= (((uint32_t)uart_readb(HOST_UART)) << 8);
+    size |= ((uint32_t)uart_readb(HOST_UART));
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, FRAME_OK);
+
+    // get first password frame
+    uart_read(HOST_UART, pbuff, 16);
+
+    reason = check_first_password(pbuff, &arena.cmd.configure.aes);
+    if (reason != 0) {
+        frame_bad(reason);
+        return;
+    }
+
+    // acknowledge host
+    uart_writeb(HOST_UART, FRAME_OK);
+
+    // send crypto for use by host
+    uart_write(HOST_UART, key, 16);
+    uart_write(HOST_UART, iv, 16);
+
+    // Older host tools send the data unchecked
+    configure_finish(size, false);
+}
+
+/**
+ * @brief Send the profiling counters to the host.
+ */
+void handle_stats(void)
+{
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'S');
+
+    profile_report(HOST_UART);
+}
+
+/**
+ * @brief Send the event trace to the host.
+ */
+void handle_diagnostics(void)
+{
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'D');
+
+    trace_dump(HOST_UART);
+}
+
+/**
+ * @brief Send the capabilities of the bootloader to the host.
+ *
+ * The capabilities are, little endian:
+ *      u8  HELLO_VERSION
+ *      u8  number of page buffers (LOAD_NUM_BUFFERS)
+ *      u16 largest frame size in bytes
+ *      u32 supported features (FEATURE_*)
+ */
+void hello_send_caps(void)
+{
+    uint32_t features = FEATURES;
+    uint16_t max_frame_size = LOAD_MAX_FRAME_SIZE;
+
+    uart_writeb(HOST_UART, HELLO_VERSION);
+    uart_writeb(HOST_UART, LOAD_NUM_BUFFERS);
+    uart_write(HOST_UART, (uint8_t *)&max_frame_size, sizeof(max_frame_size));
+    uart_write(HOST_UART, (uint8_t *)&features, sizeof(features));
+}
+
+/**
+ * @brief Exchange capabilities with the host and agree on the data frame size.
+ *
+ * The device sends its capabilities (see hello_send_caps()). The host
+ * answers with the u16 frame size it wants, and the device echoes the size
+ * it will use. That size only holds for the next command.
+ */
+void handle_hello(void)
+{
+    uint16_t frame_size;
+
+    // Acknowledge the host
+    uart_writeb(HOST_UART, 'H');
+
+    hello_send_caps();
+
+    frame_size = uart_readb(HOST_UART);
+    frame_size |= uart_readb(HOST_UART) << 8;
+    frame_size = load_set_frame_size(frame_size);
+    uart_write(HOST_UART, (uint8_t *)&frame_size, sizeof(frame_size));
+}
+
+/**
+ * @brief Framed hello.
+ *
+ * The payload is the u16 frame size wanted. The response carries the
+ * capabilities and the u16 frame size that will be used for the next command.
+ *
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_hello(uint8_t *payload, uint32_t len)
+{
+    uint16_t frame_size;
+
+    if (len != 2) {
+        return frame_refuse('H', TRACE_BAD_LENGTH);
+    }
+    frame_size = load_set_frame_size(payload[0] | (payload[1] << 8));
+
+    frame_begin(HOST_UART, 'H', 0, 8 + sizeof(frame_size));
+    hello_send_caps();
+    uart_write(HOST_UART, (uint8_t *)&frame_size, sizeof(frame_size));
+    frame_end(HOST_UART);
+    return 0;
+}
+
+/**
+ * @brief Framed stats. The response carries the profile_report().
+ *
+ * @param payload is the command payload, which must be empty.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_stats(uint8_t *payload, uint32_t len)
+{
+    if (len != 0) {
+        return frame_refuse('S', TRACE_BAD_LENGTH);
+    }
+
+    frame_begin(HOST_UART, 'S', 0, profile_report_size());
+    profile_report(HOST_UART);
+    frame_end(HOST_UART);
+    return 0;
+}
+
+/**
+ * @brief Framed diagnostics. The response carries the trace_dump().
+ *
+ * @param payload is the command payload, which must be empty.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_diagnostics(uint8_t *payload, uint32_t len)
+{
+    if (len != 0) {
+        return frame_refuse('D', TRACE_BAD_LENGTH);
+    }
+
+    frame_begin(HOST_UART, 'D', 0, trace_dump_size());
+    trace_dump(HOST_UART);
+    frame_end(HOST_UART);
+    return 0;
+}
+
+/**
+ * @brief Framed readback.
+ *
+ * The payload is the password (16B), the region ('F' or 'C') and the u32
+ * size (big endian), and optionally a u32 offset into the region after it,
+ * which may be followed by a flags byte (READBACK_FLAG_*). Without an offset
+ * the readback starts at the base of the region, and whatever is asked for
+ * past the region is sent as 0xFF. With one, the whole range must lie within
+ * the region. The data follows the response unframed, run-length encoded
+ * if READBACK_FLAG_RLE is set.
+ *
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_readback(uint8_t *payload, uint32_t len)
+{
+    uint8_t region;
+    uint32_t base;
+    uint32_t max_size;
+    uint32_t size;
+    uint32_t offset;
+    uint8_t flags = 0;
+
+    if ((len != 21) && (len != 25) && (len != 26)) {
+        return frame_refuse('R', TRACE_BAD_LENGTH);
+    }
+
+    // Check if the password supplied is the correct one
+    for(int i = 0; i < 16; i++){
+        if(payload[i] != password[i]){
+            return frame_refuse('R', TRACE_BAD_READBACK_PASSWORD);
+        }
+    }
+
+    region = payload[16];
+    if (region_bounds(region, &base, &max_size) != 0) {
+        return frame_refuse('R', TRACE_BAD_REGION);
+    }
+    size = ((uint32_t)payload[17] << 24) | ((uint32_t)payload[18] << 16) | ((uint32_t)payload[19] << 8) | payload[20];
+
+    if (len == 21) {
+        frame_reply(HOST_UART, 'R', 0);
+        readback_send(region, size);
+        return 0;
+    }
+
+    // Ranged readback
+    offset = ((uint32_t)payload[21] << 24) | ((uint32_t)payload[22] << 16) | ((uint32_t)payload[23] << 8) | payload[24];
+    if ((offset > max_size) || (size > max_size - offset)) {
+        return frame_refuse('R', TRACE_BAD_SIZE);
+    }
+    if (len == 26) {
+        flags = payload[25];
+    }
+    if (flags & ~READBACK_FLAGS) {
+        return frame_refuse('R', TRACE_BAD_FLAGS);
+    }
+
+    frame_reply(HOST_UART, 'R', 0);
+    if (flags & READBACK_FLAG_RLE) {
+        rle_send(HOST_UART, (uint8_t *)(base + offset), size);
+    } else {
+        uart_write(HOST_UART, (uint8_t *)(base + offset), size);
+    }
+    return 0;
+}
+
+/**
+ * @brief Framed digest, to check what is installed without reading it back.
+ *
+ * The payload is the password (16B), the region ('F' or 'C'), the algorithm
+ * (DIGEST_*), and the u32 offset and u32 size of the range within the region
+ * (big endian). The range must lie within the region. The response carries
+ * the algorithm and the digest.
+ *
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_digest(uint8_t *payload, uint32_t len)
+{
+    struct digest_ctx *ctx = &arena.cmd.digest.ctx;
+    uint8_t region;
+    uint8_t alg;
+    uint32_t base;
+    uint32_t max_size;
+    uint32_t offset;
+    uint32_t size;
+
+    if (len != 26) {
+        return frame_refuse('V', TRACE_BAD_LENGTH);
+    }
+
+    // Same password as readback, as a digest of a small range gives the data away
+    for(int i = 0; i < 16; i++){
+        if(payload[i] != password[i]){
+            return frame_refuse('V', TRACE_BAD_READBACK_PASSWORD);
+        }
+    }
+
+    region = payload[16];
+    if (region_bounds(region, &base, &max_size) != 0) {
+        return frame_refuse('V', TRACE_BAD_REGION);
+    }
+
+    alg = payload[17];
+    if (digest_size(alg) == 0) {
+        return frame_refuse('V', TRACE_BAD_ALGORITHM);
+    }
+
+    offset = ((uint32_t)payload[18] << 24) | ((uint32_t)payload[19] << 16) | ((uint32_t)payload[20] << 8) | payload[21];
+    size = ((uint32_t)payload[22] << 24) | ((uint32_t)payload[23] << 16) | ((uint32_t)payload[24] << 8) | payload[25];
+    if ((offset > max_size) || (size > max_size - offset)) {
+        return frame_refuse('V', TRACE_BAD_SIZE);
+    }
+
+    digest_start(ctx, alg);
+    digest_flash(ctx, base + offset, size);
+    digest_finish(ctx, arena.cmd.digest.out);
+
+    frame_begin(HOST_UART, 'V', 0, 1 + digest_size(alg));
+    uart_writeb(HOST_UART, alg);
+    uart_write(HOST_UART, arena.cmd.digest.out, digest_size(alg));
+    frame_end(HOST_UART);
+    return 0;
+}
+
+/**
+ * @brief Framed update.
+ *
+ * The payload is the encrypted version frame (32B), the u32 image size (big
+ * endian), the encrypted first password frame (16B) and the release message,
+ * up to its terminator or the end of the payload. The response carries the
+ * key and IV, and the rest of the update goes as in handle_update().
+ *
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_update(uint8_t *payload, uint32_t len)
+{
+    uint8_t *rel_msg = arena.cmd.update.rel_msg;
+    uint32_t version = 0;
+    uint32_t size;
+    uint32_t rel_msg_size = 0;
+    uint8_t reason;
+
+    if (len < 52) {
+        return frame_refuse('U', TRACE_BAD_LENGTH);
+    }
+
+    memcpy(arena.cmd.update.vbuff, payload, 32);
+    size = ((uint32_t)payload[32] << 24) | ((uint32_t)payload[33] << 16) | ((uint32_t)payload[34] << 8) | payload[35];
+    memcpy(arena.cmd.update.pbuff, payload + 36, 16);
+
+    // Copy the release message, capped at 1024 like the tools do
+    payload += 52;
+    len -= 52;
+    while ((rel_msg_size < len) && (rel_msg_size < 1024) && (payload[rel_msg_size] != '\0')) {
+        rel_msg[rel_msg_size] = payload[rel_msg_size];
+        rel_msg_size++;
+    }
+    rel_msg[rel_msg_size++] = '\0';
+
+    reason = update_check_version(&version);
+    if (reason == 0) {
+        reason = check_first_password(arena.cmd.update.pbuff, &arena.cmd.update.aes);
+    }
+    if (reason != 0) {
+        return frame_refuse('U', reason);
+    }
+
+    // send crypto for use by host
+    frame_begin(HOST_UART, 'U', 0, 32);
+    uart_write(HOST_UART, key, 16);
+    uart_write(HOST_UART, iv, 16);
+    frame_end(HOST_UART);
+
+    return update_finish(size, version, rel_msg_size, true);
+}
+
+/**
+ * @brief Framed configure.
+ *
+ * The payload is the u32 image size (big endian) and the encrypted first
+ * password frame (16B). The response carries the key and IV, and the rest of
+ * the configure goes as in handle_configure().
+ *
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_configure(uint8_t *payload, uint32_t len)
+{
+    uint32_t size;
+    uint8_t reason;
+
+    if (len != 20) {
+        return frame_refuse('C', TRACE_BAD_LENGTH);
+    }
+
+    size = ((uint32_t)payload[0] << 24) | ((uint32_t)payload[1] << 16) | ((uint32_t)payload[2] << 8) | payload[3];
+    memcpy(arena.cmd.configure.pbuff, payload + 4, 16);
+
+    reason = check_first_password(arena.cmd.configure.pbuff, &arena.cmd.configure.aes);
+    if (reason != 0) {
+        return frame_refuse('C', reason);
+    }
+
+    // send crypto for use by host
+    frame_begin(HOST_UART, 'C', 0, 32);
+    uart_write(HOST_UART, key, 16);
+    uart_write(HOST_UART, iv, 16);
+    frame_end(HOST_UART);
+
+    return configure_finish(size, true);
 }
 
 /**
- * @brief Host interface polling loop to receive configure, update, readback,
- * and boot commands.
+ * @brief Send the combined response of the batch being run, if there is one.
+ *
+ * The response data is the u8 number of commands N, then N x { u8 command,
+ * u8 status, u8 reason }. Commands that did not run have reason BATCH_SKIPPED.
+ */
+void batch_reply(void)
+{
+    uint8_t reason = 0;
+    uint8_t i;
+
+    if (!batch_active) {
+        return;
+    }
+    batch_active = false;
+
+    for (i = 0; i < batch_ran; i++) {
+        if (batch_reasons[i] != 0) {
+            reason = batch_reasons[i];
+        }
+    }
+
+    frame_begin(HOST_UART, FRAME_CMD_BATCH, reason, 1 + 3 * batch_num);
+    uart_writeb(HOST_UART, batch_num);
+    for (i = 0; i < batch_num; i++) {
+        uart_writeb(HOST_UART, batch_cmds[i]);
+        if (i < batch_ran) {
+            uart_writeb(HOST_UART, batch_reasons[i] == 0 ? FRAME_OK : FRAME_BAD);
+            uart_writeb(HOST_UART, batch_reasons[i]);
+        } else {
+            uart_writeb(HOST_UART, FRAME_BAD);
+            uart_writeb(HOST_UART, BATCH_SKIPPED);
+        }
+    }
+    frame_end(HOST_UART);
+}
+
+/**
+ * @brief Framed boot.
+ *
+ * The response carries the release message, with its terminator. In a batch
+ * the combined response goes out after it, right before the firmware starts.
+ *
+ * @param payload is the command payload, which must be empty.
+ * @param len is the payload length.
+ * @return why the boot was refused (TRACE_BAD_*). Does not return otherwise.
+ */
+uint8_t frame_boot(uint8_t *payload, uint32_t len)
+{
+    uint8_t *rel_msg = (uint8_t *)FIRMWARE_RELEASE_MSG_PTR;
+    uint8_t reason;
+
+    if (len != 0) {
+        return frame_refuse('B', TRACE_BAD_LENGTH);
+    }
+
+    // Refuse to boot if there is no complete firmware install
+    if (!(metadata_read(META_FLAGS) & META_FLAG_FW_VALID)) {
+        return frame_refuse('B', TRACE_BAD_NO_FIRMWARE);
+    }
+
+    // Refuse to boot firmware that has changed since it was installed
+    reason = boot_copy();
+    if (reason != 0) {
+        return frame_refuse('B', reason);
+    }
+
+    frame_begin(HOST_UART, 'B', 0, strlen((char *)rel_msg) + 1);
+    uart_write(HOST_UART, rel_msg, strlen((char *)rel_msg) + 1);
+    frame_end(HOST_UART);
+
+    // The boot is the last command of a batch
+    batch_ran = batch_num;
+    batch_reply();
+
+    boot_jump();
+    return 0;
+}
+
+/**
+ * @brief Run one framed command.
+ *
+ * @param cmd is the command.
+ * @param payload is the command payload.
+ * @param len is the payload length.
+ * @return 0 on success, or why the command failed (TRACE_BAD_*).
+ */
+uint8_t frame_dispatch(uint8_t cmd, uint8_t *payload, uint32_t len)
+{
+    uint8_t reason;
+
+    trace_event(TRACE_CMD_ENTER, cmd);
+
+    switch (cmd) {
+    case 'C':
+        reason = frame_configure(payload, len);
+        break;
+    case 'U':
+        reason = frame_update(payload, len);
+        break;
+    case 'R':
+        reason = frame_readback(payload, len);
+        break;
+    case 'V':
+        reason = frame_digest(payload, len);
+        break;
+    case 'B':
+        reason = frame_boot(payload, len);
+        break;
+    case 'S':
+        reason = frame_stats(payload, len);
+        break;
+    case 'D':
+        reason = frame_diagnostics(payload, len);
+        break;
+    case 'H':
+        reason = frame_hello(payload, len);
+        break;
+    default:
+        reason = frame_refuse(cmd, TRACE_BAD_COMMAND);
+        break;
+    }
+
+    // As in main(), a negotiated frame size only holds for the next command
+    if (cmd != 'H') {
+        load_set_frame_size(FLASH_PAGE_SIZE);
+    }
+
+    trace_event(TRACE_CMD_EXIT, cmd);
+    return reason;
+}
+
+/**
+ * @brief Run several framed commands in a row, and answer them together.
+ *
+ * The payload is a list of commands, each { u8 command, u16 length (little
+ * endian), payload }. The whole list is checked before any of it runs. Each
+ * command sends its own response and then the batch sends a combined one
+ * (see batch_reply()). A command that fails ends the batch. A boot may only
+ * come last.
+ *
+ * @param payload is the batch payload.
+ * @param len is the payload length.
+ */
+void handle_batch(uint8_t *payload, uint32_t len)
+{
+    uint16_t offsets[BATCH_MAX_ENTRIES];
+    uint16_t lens[BATCH_MAX_ENTRIES];
+    uint32_t pos = 0;
+    uint8_t i;
+
+    batch_num = 0;
+    while (pos < len) {
+        if ((batch_num == BATCH_MAX_ENTRIES) || (len - pos < 3)) {
+            frame_refuse(FRAME_CMD_BATCH, TRACE_BAD_LENGTH);
+            return;
+        }
+        batch_cmds[batch_num] = payload[pos];
+        lens[batch_num] = payload[pos + 1] | (payload[pos + 2] << 8);
+        offsets[batch_num] = pos + 3;
+        if (lens[batch_num] > len - pos - 3) {
+            frame_refuse(FRAME_CMD_BATCH, TRACE_BAD_LENGTH);
+            return;
+        }
+        if ((batch_cmds[batch_num] == FRAME_CMD_BATCH) ||
+            ((batch_num > 0) && (batch_cmds[batch_num - 1] == 'B'))) {
+            frame_refuse(FRAME_CMD_BATCH, TRACE_BAD_COMMAND);
+            return;
+        }
+        pos += 3 + lens[batch_num];
+        batch_num++;
+    }
+
+    batch_active = true;
+    batch_ran = 0;
+    while (batch_ran < batch_num) {
+        i = batch_ran;
+
+        // Each command gets the whole command deadline
+        timeout_start(TIMEOUT_COMMAND);
+
+        // A boot that goes ahead reports the batch before it returns, as OK
+        batch_reasons[i] = 0;
+        batch_reasons[i] = frame_dispatch(batch_cmds[i], payload + offsets[i], lens[i]);
+        batch_ran++;
+        if (batch_reasons[i] != 0) {
+            break;
+        }
+    }
+
+    batch_reply();
+}
+
+/**
+ * @brief Receive a framed command, whose FRAME_SOF has been read, and run it.
+ */
+void handle_frame(void)
+{
+    uint8_t cmd;
+    uint32_t len;
+    uint8_t reason;
+
+    // Left over from a batch that timed out
+    batch_active = false;
+
+    reason = frame_recv(HOST_UART, &cmd, arena.frame, &len);
+    if (reason != 0) {
+        frame_refuse(cmd, reason);
+        return;
+    }
+
+    if (cmd == FRAME_CMD_BATCH) {
+        handle_batch(arena.frame, len);
+    } else {
+        frame_dispatch(cmd, arena.frame, len);
+    }
+}
+
+/**
+ * @brief Host interface polling loop to receive hello, configure, update,
+ * readback, boot, stats and diagnostics commands, legacy or framed, and
+ * framed digest commands.
  * 
  * @return int
  */
@@ -476,14 +1326,14 @@ int main(void){
     // Setting up the eeprom
     HWREG(SYSCTL_RCGCEEPROM) |= SYSCTL_RCGCEEPROM_R0;
     while (!HWREG(SYSCTL_PREEPROM));
-    EEPROMInit();
+    MAP_EEPROMInit();
 
     // Side note: Would not have figured out that part above without the organizers. Thanks Jake!
 
     // Reading from eeprom to the 32 bit arrays
-    EEPROMRead(key32, (uint32_t)KEY_OFFSET_PTR, 16);
-    EEPROMRead(iv32, (uint32_t)IV_OFFSET_PTR, 16);
-    EEPROMRead(password32, (uint32_t)PASSWORD_OFFSET_PTR, 16);
+    MAP_EEPROMRead(key32, (uint32_t)KEY_OFFSET_PTR, 16);
+    MAP_EEPROMRead(iv32, (uint32_t)IV_OFFSET_PTR, 16);
+    MAP_EEPROMRead(password32, (uint32_t)PASSWORD_OFFSET_PTR, 16);
 
     // Convert those 4 bytes of 32 bits into 16 bytes of 8 bits
     // There has to be an easier way to do this LOL
@@ -550,18 +1400,52 @@ int main(void){
 
     uint8_t cmd = 0;
 
-    // Memory is always initialized as 1s, so on the first startup we need to set the current version to the oldest as defined by the host
-    uint32_t current_version = *(uint32_t *)FIRMWARE_VERSION_PTR;
-    if (current_version == 0xFFFFFFFF){
-        flash_write_word((uint32_t)OLDEST_VERSION, FIRMWARE_VERSION_PTR);
+    // Load the metadata record. On the first startup there is none yet, so we create it with the oldest
+    // version as defined by the host, carrying over anything an older bootloader left in the flash metadata
+    if (metadata_init() != 0) {
+        uint32_t version = *(uint32_t *)FIRMWARE_VERSION_PTR;
+        uint32_t fw_size = *(uint32_t *)FIRMWARE_SIZE_PTR;
+        uint32_t cfg_size = *(uint32_t *)CONFIGURATION_SIZE_PTR;
+        uint32_t flags = 0;
+
+        // Flash is always initialized as 1s
+        if (version == 0xFFFFFFFF) {
+            version = (uint32_t)OLDEST_VERSION;
+        }
+        if (fw_size == 0xFFFFFFFF) {
+            fw_size = 0;
+        } else {
+            flags |= META_FLAG_FW_VALID;
+        }
+        if (cfg_size == 0xFFFFFFFF) {
+            cfg_size = 0;
+        } else {
+            flags |= META_FLAG_CFG_VALID;
+        }
+        metadata_format(version, fw_size, cfg_size, flags);
     }
     
     // Initialize IO components
     uart_init();
+    power_init();
+    profile_init();
+    timeout_init();
+
+    // A command that runs out of time while waiting for the host comes back here
+    if (setjmp(timeout_env) != 0) {
+        // Throw away whatever is left of it
+        while (uart_avail(HOST_UART)) {
+            uart_readb(HOST_UART);
+        }
+        load_set_frame_size(FLASH_PAGE_SIZE);
+    }
 
     // Handle host commands
     while (1) {
+        // No deadline while waiting for a command
         cmd = uart_readb(HOST_UART);
+        trace_event(TRACE_CMD_ENTER, cmd);
+        timeout_start(TIMEOUT_COMMAND);
 
         switch (cmd) {
         case 'C':
@@ -576,8 +1460,30 @@ int main(void){
         case 'B':
             handle_boot();
             break;
+        case 'S':
+            handle_stats();
+            break;
+        case 'D':
+            handle_diagnostics();
+            break;
+        case 'H':
+            handle_hello();
+            break;
+        case FRAME_SOF:
+            handle_frame();
+            break;
         default:
             break;
         }
+
+        // A negotiated frame size only holds for the command after the hello,
+        // so a host that never sends one always gets single page frames.
+        // Framed commands see to this themselves.
+        if ((cmd != 'H') && (cmd != FRAME_SOF)) {
+            load_set_frame_size(FLASH_PAGE_SIZE);
+        }
+
+        timeout_stop();
+        trace_event(TRACE_CMD_EXIT, cmd);
     }
 }
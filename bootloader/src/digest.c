@@ -0,0 +1,206 @@
+/**
+ * @file digest.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief CRC32 and SHA-256 digests of flash contents.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "driverlib/sw_crc.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "digest.h"
+
+#define ROR(x, n)   (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256_init[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+/**
+ * @brief Run the SHA-256 compression function over one 64 byte block.
+ *
+ * @param state is the hash value to update.
+ * @param block is the block.
+ */
+static void sha256_block(uint32_t *state, const uint8_t *block)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t t1, t2;
+    uint32_t i;
+
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        t1 = ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        t2 = ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        w[i] = t1 + w[i - 7] + t2 + w[i - 16];
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; i++) {
+        t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/**
+ * @brief Get the size of a digest.
+ *
+ * @param alg is the algorithm (DIGEST_*).
+ * @return the number of bytes digest_finish() writes, or 0 if alg is unknown.
+ */
+uint32_t digest_size(uint32_t alg)
+{
+    switch (alg) {
+    case DIGEST_CRC32:
+        return 4;
+    case DIGEST_SHA256:
+        return 32;
+    default:
+        return 0;
+    }
+}
+
+/**
+ * @brief Start a digest.
+ *
+ * @param ctx is the digest to start.
+ * @param alg is the algorithm (DIGEST_*), which must be known.
+ */
+void digest_start(struct digest_ctx *ctx, uint32_t alg)
+{
+    ctx->alg = alg;
+    ctx->crc = 0xFFFFFFFF;
+    memcpy(ctx->state, sha256_init, sizeof(ctx->state));
+    ctx->used = 0;
+    ctx->total = 0;
+}
+
+/**
+ * @brief Add data to a digest.
+ *
+ * @param ctx is the digest.
+ * @param data is the data to add.
+ * @param len is the number of bytes to add.
+ */
+void digest_update(struct digest_ctx *ctx, const uint8_t *data, uint32_t len)
+{
+    uint32_t n;
+
+    if (ctx->alg == DIGEST_CRC32) {
+        ctx->crc = MAP_Crc32(ctx->crc, data, len);
+        return;
+    }
+
+    ctx->total += len;
+    while (len > 0) {
+        // Hash whole blocks straight from the data when nothing is buffered
+        if ((ctx->used == 0) && (len >= sizeof(ctx->block))) {
+            sha256_block(ctx->state, data);
+            data += sizeof(ctx->block);
+            len -= sizeof(ctx->block);
+            continue;
+        }
+
+        n = sizeof(ctx->block) - ctx->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(ctx->block + ctx->used, data, n);
+        ctx->used += n;
+        data += n;
+        len -= n;
+
+        if (ctx->used == sizeof(ctx->block)) {
+            sha256_block(ctx->state, ctx->block);
+            ctx->used = 0;
+        }
+    }
+}
+
+/**
+ * @brief Finish a digest.
+ *
+ * @param ctx is the digest.
+ * @param out is where to write the digest, digest_size() bytes.
+ */
+void digest_finish(struct digest_ctx *ctx, uint8_t *out)
+{
+    uint32_t bits;
+    uint32_t i;
+
+    if (ctx->alg == DIGEST_CRC32) {
+        ctx->crc ^= 0xFFFFFFFF;
+        memcpy(out, &ctx->crc, 4);
+        return;
+    }
+
+    // Pad with 0x80, zeros and the length in bits, big endian. Flash regions
+    // are far below 512MB, so the top word of the length is always zero.
+    bits = ctx->total << 3;
+    ctx->block[ctx->used++] = 0x80;
+    if (ctx->used > sizeof(ctx->block) - 8) {
+        memset(ctx->block + ctx->used, 0, sizeof(ctx->block) - ctx->used);
+        sha256_block(ctx->state, ctx->block);
+        ctx->used = 0;
+    }
+    memset(ctx->block + ctx->used, 0, sizeof(ctx->block) - 4 - ctx->used);
+    ctx->block[60] = bits >> 24;
+    ctx->block[61] = bits >> 16;
+    ctx->block[62] = bits >> 8;
+    ctx->block[63] = bits;
+    sha256_block(ctx->state, ctx->block);
+
+    for (i = 0; i < 8; i++) {
+        out[4 * i] = ctx->state[i] >> 24;
+        out[4 * i + 1] = ctx->state[i] >> 16;
+        out[4 * i + 2] = ctx->state[i] >> 8;
+        out[4 * i + 3] = ctx->state[i];
+    }
+}
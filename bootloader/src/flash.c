@@ -19,6 +19,8 @@
 #include "inc/hw_types.h"
 
 #include "flash.h"
+#include "power.h"
+#include "profile.h"
 
 /**
  * @brief Erases a block of flash.
@@ -29,9 +31,30 @@
  */
 int32_t flash_erase_page(uint32_t addr)
 {
+    int32_t status;
+
+    PROFILE_BEGIN(PROF_FLASH_ERASE);
+    // Clear the flash access and error interrupts.
+    HWREG(FLASH_FCMISC) = (FLASH_FCMISC_AMISC | FLASH_FCMISC_VOLTMISC | FLASH_FCMISC_ERMISC);
+
     // Erase page containing this address
-    return FlashErase(addr & ~(FLASH_PAGE_SIZE - 1));
-} 
+    HWREG(FLASH_FMA) = addr & ~(FLASH_PAGE_SIZE - 1) & FLASH_FMA_OFFSET_M;
+    HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_ERASE;
+
+    // Sleep until the erase bit gets cleared
+    while (HWREG(FLASH_FMC) & FLASH_FMC_ERASE) {
+        power_sleep();
+    }
+
+    // Return an error if an access violation or erase error occurred.
+    status = 0;
+    if (HWREG(FLASH_FCRIS) & (FLASH_FCRIS_ARIS | FLASH_FCRIS_VOLTRIS | FLASH_FCRIS_ERRIS)) {
+        status = -1;
+    }
+    PROFILE_END(PROF_FLASH_ERASE);
+
+    return status;
+}
 
 /**
  * @brief Writes a word to flash.
@@ -62,8 +85,10 @@ int32_t flash_write_word(uint32_t data, uint32_t addr)
     // Set the memory write key and the write bit
     HWREG(FLASH_FMC) = FLASH_FMC_WRKEY | FLASH_FMC_WRITE;
 
-    // Wait for the write bit to get cleared
-    while(HWREG(FLASH_FMC) & FLASH_FMC_WRITE);
+    // Sleep until the write bit gets cleared
+    while (HWREG(FLASH_FMC) & FLASH_FMC_WRITE) {
+        power_sleep();
+    }
 
     // Return an error if an access violation occurred.
     if(HWREG(FLASH_FCRIS) & (FLASH_FCRIS_ARIS | FLASH_FCRIS_VOLTRIS | FLASH_FCRIS_INVDRIS | FLASH_FCRIS_PROGRIS)) {
@@ -96,6 +121,7 @@ int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
         return -1;
     }
 
+    PROFILE_BEGIN(PROF_FLASH_WRITE);
     // Loop over the words to be programmed.
     for (i = 0; i < count; i++) {
         status = flash_write_word(data[i], addr);
@@ -106,6 +132,7 @@ int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
 
         addr += 4;
     }
+    PROFILE_END(PROF_FLASH_WRITE);
 
     // Success
     return(0);
@@ -0,0 +1,107 @@
+/**
+ * @file frame.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Framed host commands.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdint.h>
+
+#include "frame.h"
+#include "load.h"
+#include "trace.h"
+#include "uart.h"
+
+/**
+ * @brief Receive the rest of a frame whose FRAME_SOF has been read.
+ *
+ * A frame that is too long is read to its end and thrown away.
+ *
+ * @param uart is the base address of the UART port to read from.
+ * @param cmd is where to store the command.
+ * @param buf is where to store the payload, FRAME_MAX_PAYLOAD bytes.
+ * @param len is where to store the payload length.
+ * @return 0 on success, or why the frame was rejected (TRACE_BAD_*).
+ */
+uint8_t frame_recv(uint32_t uart, uint8_t *cmd, uint8_t *buf, uint32_t *len)
+{
+    uint32_t i;
+    uint16_t sum;
+    uint16_t check;
+
+    uart_sum_start();
+    *cmd = (uint8_t)uart_readb(uart);
+    *len = (uint32_t)uart_readb(uart);
+    *len |= (uint32_t)uart_readb(uart) << 8;
+
+    if (*len > FRAME_MAX_PAYLOAD) {
+        // Skip over it, so the next command starts in the right place
+        for (i = 0; i < *len + 2; i++) {
+            uart_readb(uart);
+        }
+        return TRACE_BAD_LENGTH;
+    }
+
+    uart_read(uart, buf, *len);
+    sum = uart_sum();
+
+    check = (uint16_t)uart_readb(uart);
+    check |= (uint16_t)uart_readb(uart) << 8;
+    if (check != sum) {
+        return TRACE_BAD_CHECKSUM;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Start a response frame.
+ *
+ * The caller writes len bytes of data with uart_write() and then calls
+ * frame_end().
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param cmd is the command answered.
+ * @param reason is 0 if the command succeeded, or why it failed (TRACE_BAD_*).
+ * @param len is the number of data bytes after the status and reason.
+ */
+void frame_begin(uint32_t uart, uint8_t cmd, uint8_t reason, uint32_t len)
+{
+    len += 2;
+
+    uart_writeb(uart, FRAME_SOF);
+    uart_sum_start();
+    uart_writeb(uart, cmd | FRAME_RESPONSE);
+    uart_writeb(uart, len);
+    uart_writeb(uart, len >> 8);
+    uart_writeb(uart, reason == 0 ? FRAME_OK : FRAME_BAD);
+    uart_writeb(uart, reason);
+}
+
+/**
+ * @brief Finish a response frame.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void frame_end(uint32_t uart)
+{
+    uint16_t sum = uart_sum();
+
+    uart_writeb(uart, sum);
+    uart_writeb(uart, sum >> 8);
+}
+
+/**
+ * @brief Send a response frame without data.
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param cmd is the command answered.
+ * @param reason is 0 if the command succeeded, or why it failed (TRACE_BAD_*).
+ */
+void frame_reply(uint32_t uart, uint8_t cmd, uint8_t reason)
+{
+    frame_begin(uart, cmd, reason, 0);
+    frame_end(uart);
+}
@@ -0,0 +1,378 @@
+/**
+ * @file load.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Pipelined transfer of firmware and configuration data into flash.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "driverlib/sw_crc.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "arena.h"
+#include "flash.h"
+#include "load.h"
+#include "profile.h"
+#include "queue.h"
+#include "sched.h"
+#include "timeout.h"
+#include "trace.h"
+#include "uart.h"
+
+static struct queue load_free;      // buffers ready to receive into
+static struct queue load_received;  // pages waiting to be programmed
+static struct queue load_committed; // pages waiting to be acknowledged
+
+// Transfer state, kept here as task locals do not survive a wait
+static uint32_t load_uart;
+static uint32_t load_dst;           // address of the region
+static uint32_t load_size;          // bytes in the whole transfer
+static uint32_t load_frame_size = FLASH_PAGE_SIZE;  // bytes per frame, see load_set_frame_size()
+static uint32_t load_pages;         // pages in the whole transfer
+static uint32_t load_frames;        // frames in the whole transfer
+static uint32_t load_programmed;    // pages programmed so far
+static uint32_t load_acked;         // frames acknowledged so far
+static bool load_checked;           // whether frames carry an index and CRC, see load_data()
+
+// Frame counters for the stats report, see load_report()
+static uint32_t load_stat_frames;   // frames received
+static uint32_t load_stat_rejected; // frames that failed their CRC or had a bad index
+
+// Program task state
+static struct load_page *load_prog_page;
+static uint32_t load_prog_word;
+
+// Receive task state
+static struct load_page *load_rx_pages[LOAD_NUM_BUFFERS / 2];   // pages of the current frame
+static uint32_t load_rx_page_num;   // page of the current frame being received
+static uint32_t load_rx_frame_pages;    // pages of the current frame
+static uint32_t load_rx_frame_left; // bytes of the current frame still to receive
+static uint32_t load_rx_size;       // bytes of the current page to receive
+static uint8_t load_rx_header[LOAD_CRC_SIZE];   // index or CRC of the current frame
+static uint32_t load_rx_got;
+static uint32_t load_rx_index;      // index of the current frame
+static uint32_t load_rx_crc;        // running CRC32 of the current frame
+static uint32_t load_rx_check;      // final CRC32 of the current frame's index and data
+static uint32_t load_good;          // frames received intact so far, each index once
+static uint8_t load_rx_seen[(LOAD_MAX_FRAMES + 7) / 8]; // which frame indexes have been received
+static uint16_t load_rx_num;        // frames received so far, good or bad
+#ifdef PROFILE
+static uint32_t load_rx_start;
+#endif
+
+// Transmit task state
+static struct load_page *load_tx_page;
+
+/**
+ * @brief Take what the UART FIFO holds into a buffer, adding it to the frame's CRC.
+ *
+ * @param buf is the buffer to fill.
+ * @param size is the size of the buffer.
+ */
+static void load_rx_drain(uint8_t *buf, uint32_t size)
+{
+    uint32_t start = load_rx_got;
+
+    while ((load_rx_got < size) && uart_avail(load_uart)) {
+        buf[load_rx_got++] = (uint8_t)uart_readb(load_uart);
+    }
+    if (load_checked) {
+        load_rx_crc = MAP_Crc32(load_rx_crc, buf + start, load_rx_got - start);
+    }
+}
+
+/**
+ * @brief Queue the pages of a frame that passed its CRC, or of an unchecked
+ * frame, for programming.
+ */
+static void load_rx_accept(void)
+{
+    uint32_t i;
+    uint32_t addr = load_dst + load_rx_index * load_frame_size;
+    uint32_t end = load_dst + load_size;
+    struct load_page *page;
+
+    for (i = 0; i < load_rx_frame_pages; i++, addr += FLASH_PAGE_SIZE) {
+        page = load_rx_pages[i];
+        if (addr >= end) {
+            // Padding of the last frame
+            queue_put(&load_free, page);
+            continue;
+        }
+
+        // Keep the flash after the image erased, whatever the host padded with
+        if (addr + FLASH_PAGE_SIZE > end) {
+            memset(page->data + (end - addr), 0xFF, addr + FLASH_PAGE_SIZE - end);
+        }
+        page->addr = addr;
+        page->last = (i == load_rx_frame_pages - 1) || (addr + FLASH_PAGE_SIZE >= end);
+        queue_put(&load_received, page);
+    }
+}
+
+/**
+ * @brief Free the pages of a frame that is not programmed.
+ */
+static void load_rx_free(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < load_rx_frame_pages; i++) {
+        queue_put(&load_free, load_rx_pages[i]);
+    }
+}
+
+/**
+ * @brief Receive task: check the frames from the host and split them into pages.
+ *
+ * A checked frame is an index, frame size bytes of data and a CRC32 of the
+ * two. The pages of a frame are held until its CRC has been checked, so a
+ * corrupted frame is never programmed. It is answered with FRAME_BAD and the
+ * number of the frame in the order received, and the host sends it again.
+ * A frame whose index has already been received is acked but not programmed
+ * again, so the transfer only completes once every index has arrived.
+ *
+ * An unchecked frame is just its data, and the last one is only as long as
+ * what is left of the transfer.
+ *
+ * @param t is the task.
+ * @return the task state (TASK_*).
+ */
+int32_t load_rx_task(struct task *t)
+{
+    uint32_t crc;
+
+    TASK_BEGIN(t);
+
+    while (load_good < load_frames) {
+        // Each frame gets its own deadline
+        timeout_start(TIMEOUT_FRAME);
+#ifdef PROFILE
+        load_rx_start = profile_now();
+#endif
+
+        load_rx_crc = 0xFFFFFFFF;
+        if (load_checked) {
+            load_rx_got = 0;
+            while (load_rx_got < LOAD_INDEX_SIZE) {
+                TASK_WAIT_UNTIL(t, uart_avail(load_uart));
+                load_rx_drain(load_rx_header, LOAD_INDEX_SIZE);
+            }
+            load_rx_index = load_rx_header[0] | ((uint32_t)load_rx_header[1] << 8);
+            load_rx_frame_left = load_frame_size;
+        } else {
+            // Unchecked frames come in order
+            load_rx_index = load_good;
+            load_rx_frame_left = load_size - load_rx_index * load_frame_size;
+            if (load_rx_frame_left > load_frame_size) {
+                load_rx_frame_left = load_frame_size;
+            }
+        }
+        load_rx_frame_pages = (load_rx_frame_left + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+
+        for (load_rx_page_num = 0; load_rx_page_num < load_rx_frame_pages; load_rx_page_num++) {
+            TASK_WAIT_UNTIL(t, !queue_empty(&load_free));
+            load_rx_pages[load_rx_page_num] = queue_get(&load_free);
+
+            load_rx_got = 0;
+            load_rx_size = load_rx_frame_left > FLASH_PAGE_SIZE ? FLASH_PAGE_SIZE : load_rx_frame_left;
+            while (load_rx_got < load_rx_size) {
+                TASK_WAIT_UNTIL(t, uart_avail(load_uart));
+                load_rx_drain(load_rx_pages[load_rx_page_num]->data, load_rx_size);
+            }
+            load_rx_frame_left -= load_rx_size;
+        }
+
+        if (load_checked) {
+            // The CRC itself is not part of the sum
+            load_rx_check = load_rx_crc ^ 0xFFFFFFFF;
+            load_rx_got = 0;
+            while (load_rx_got < LOAD_CRC_SIZE) {
+                TASK_WAIT_UNTIL(t, uart_avail(load_uart));
+                load_rx_drain(load_rx_header, LOAD_CRC_SIZE);
+            }
+            crc = load_rx_header[0] | ((uint32_t)load_rx_header[1] << 8) |
+                  ((uint32_t)load_rx_header[2] << 16) | ((uint32_t)load_rx_header[3] << 24);
+        } else {
+            // Nothing to check
+            crc = load_rx_check;
+        }
+
+        if ((crc == load_rx_check) && (load_rx_index < load_frames) &&
+            !(load_rx_seen[load_rx_index / 8] & (1 << (load_rx_index % 8)))) {
+#ifdef PROFILE
+            profile_record(PROF_UART_READ, load_rx_start);
+#endif
+            trace_event(TRACE_FRAME_RX, load_rx_index);
+            load_rx_seen[load_rx_index / 8] |= 1 << (load_rx_index % 8);
+            load_rx_accept();
+            load_good++;
+        } else if ((crc == load_rx_check) && (load_rx_index < load_frames)) {
+            // A frame already stored, so only the other frames can complete the
+            // transfer. Ack it right away to give the host its credit back.
+            load_rx_free();
+            uart_writeb(load_uart, FRAME_OK);
+        } else {
+            trace_event(TRACE_FRAME_BAD, TRACE_BAD_CRC);
+            load_rx_free();
+            uart_writeb(load_uart, FRAME_BAD);
+            uart_writeb(load_uart, load_rx_num);
+            uart_writeb(load_uart, load_rx_num >> 8);
+            load_stat_rejected++;
+        }
+        load_rx_num++;
+        load_stat_frames++;
+    }
+
+    TASK_END(t);
+}
+
+/**
+ * @brief Program task: program each received page into the erased region.
+ *
+ * @param t is the task.
+ * @return the task state (TASK_*).
+ */
+int32_t load_program_task(struct task *t)
+{
+    TASK_BEGIN(t);
+
+    while (load_programmed < load_pages) {
+        TASK_WAIT_UNTIL(t, !queue_empty(&load_received) && !queue_full(&load_committed));
+        load_prog_page = queue_get(&load_received);
+
+        // write flash page, a few words at a time
+        for (load_prog_word = 0; load_prog_word < (FLASH_PAGE_SIZE >> 2); load_prog_word += LOAD_WRITE_WORDS) {
+            flash_write((uint32_t *)load_prog_page->data + load_prog_word,
+                        load_prog_page->addr + (load_prog_word << 2), LOAD_WRITE_WORDS);
+            TASK_YIELD(t);
+        }
+        trace_event(TRACE_PAGE_COMMIT, load_prog_page->addr / FLASH_PAGE_SIZE);
+
+        queue_put(&load_committed, load_prog_page);
+        load_programmed++;
+    }
+
+    TASK_END(t);
+}
+
+/**
+ * @brief Transmit task: acknowledge each frame to the host once all its pages are programmed.
+ *
+ * @param t is the task.
+ * @return the task state (TASK_*).
+ */
+int32_t load_tx_task(struct task *t)
+{
+    TASK_BEGIN(t);
+
+    while (load_acked < load_frames) {
+        TASK_WAIT_UNTIL(t, !queue_empty(&load_committed));
+        load_tx_page = queue_get(&load_committed);
+
+        // send frame ok after the last page of a frame, its buffers can take the next frame
+        if (load_tx_page->last) {
+            uart_writeb(load_uart, FRAME_OK);
+            load_acked++;
+        }
+        queue_put(&load_free, load_tx_page);
+    }
+
+    TASK_END(t);
+}
+
+/**
+ * @brief Set the frame size of the next transfer.
+ *
+ * The size is rounded down to whole pages and limited to LOAD_MAX_FRAME_SIZE.
+ * It stays in effect until it is set again.
+ *
+ * @param size is the requested number of bytes per frame.
+ * @return the frame size that will be used.
+ */
+uint32_t load_set_frame_size(uint32_t size)
+{
+    size -= size % FLASH_PAGE_SIZE;
+    if (size < FLASH_PAGE_SIZE) {
+        size = FLASH_PAGE_SIZE;
+    } else if (size > LOAD_MAX_FRAME_SIZE) {
+        size = LOAD_MAX_FRAME_SIZE;
+    }
+
+    load_frame_size = size;
+    return size;
+}
+
+/**
+ * @brief Erase the flash pages that load_data() will program.
+ *
+ * @param dst is the starting page address to store the data.
+ * @param size is the number of bytes to load.
+ */
+void load_erase(uint32_t dst, uint32_t size)
+{
+    uint32_t addr;
+
+    for (addr = dst; addr < dst + size; addr += FLASH_PAGE_SIZE) {
+        flash_erase_page(addr);
+    }
+}
+
+/**
+ * @brief Read data from a UART interface and program to flash memory.
+ *
+ * @param interface is the base address of the UART interface to read from.
+ * @param dst is the starting page address to store the data.
+ * @param size is the number of bytes to load.
+ * @param checked is whether the frames carry an index and CRC32.
+ */
+void load_data(uint32_t interface, uint32_t dst, uint32_t size, bool checked)
+{
+    uint32_t i;
+    struct task tasks[] = {
+        { load_rx_task, 0, 0 },
+        { load_program_task, 0, 0 },
+        { load_tx_task, 0, 0 },
+    };
+
+    queue_init(&load_free);
+    queue_init(&load_received);
+    queue_init(&load_committed);
+    for (i = 0; i < LOAD_NUM_BUFFERS; i++) {
+        queue_put(&load_free, &arena.pages[i]);
+    }
+
+    load_uart = interface;
+    load_dst = dst;
+    load_size = size;
+    load_checked = checked;
+    load_pages = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE;
+    load_frames = (size + load_frame_size - 1) / load_frame_size;
+    load_programmed = 0;
+    load_acked = 0;
+    load_good = 0;
+    load_rx_num = 0;
+    memset(load_rx_seen, 0, sizeof(load_rx_seen));
+
+    sched_run(tasks, sizeof(tasks) / sizeof(tasks[0]));
+}
+
+/**
+ * @brief Send the frame counters to the host and clear them.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void load_report(uint32_t uart)
+{
+    uart_write(uart, (uint8_t *)&load_stat_frames, sizeof(load_stat_frames));
+    uart_write(uart, (uint8_t *)&load_stat_rejected, sizeof(load_stat_rejected));
+
+    load_stat_frames = 0;
+    load_stat_rejected = 0;
+}
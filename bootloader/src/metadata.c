@@ -0,0 +1,129 @@
+/**
+ * @file metadata.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Bootloader metadata record stored in EEPROM.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driverlib/eeprom.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "metadata.h"
+
+// RAM copy of the EEPROM record
+static uint32_t meta_cache[META_NUM_FIELDS];
+
+/**
+ * @brief Load the metadata record from EEPROM into the RAM cache.
+ *
+ * EEPROMInit() must have been called first.
+ *
+ * @return 0 if a valid record was loaded, or -1 if the EEPROM does not hold a
+ * record yet and metadata_format() must be called.
+ */
+int32_t metadata_init(void)
+{
+    MAP_EEPROMRead(meta_cache, METADATA_EEPROM_PTR, sizeof(meta_cache));
+
+    if (meta_cache[META_MAGIC] != METADATA_MAGIC) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Write a fresh metadata record to EEPROM.
+ *
+ * The magic word is programmed last so a record that was only partially
+ * written is never accepted by metadata_init().
+ *
+ * @param version is the initial firmware version.
+ * @param fw_size is the initial firmware size.
+ * @param cfg_size is the initial configuration size.
+ * @param flags is the initial set of boot flags.
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_format(uint32_t version, uint32_t fw_size, uint32_t cfg_size, uint32_t flags)
+{
+    meta_cache[META_MAGIC] = METADATA_MAGIC;
+    meta_cache[META_FW_VERSION] = version;
+    meta_cache[META_FW_SIZE] = fw_size;
+    meta_cache[META_CFG_SIZE] = cfg_size;
+    meta_cache[META_FLAGS] = flags;
+    meta_cache[META_FW_CRC] = 0;
+
+    // Everything but the magic word first
+    if (MAP_EEPROMProgram(&meta_cache[META_FW_VERSION], METADATA_EEPROM_PTR + (META_FW_VERSION << 2),
+                          (META_NUM_FIELDS - 1) << 2) != 0) {
+        return -1;
+    }
+
+    // Then the magic word to mark the record as complete
+    if (MAP_EEPROMProgram(&meta_cache[META_MAGIC], METADATA_EEPROM_PTR, 4) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Read a metadata field from the RAM cache.
+ *
+ * @param field is the field to read (META_*).
+ * @return the cached value of the field.
+ */
+uint32_t metadata_read(uint32_t field)
+{
+    return meta_cache[field];
+}
+
+/**
+ * @brief Write a metadata field through to EEPROM.
+ *
+ * Only the one word holding the field is programmed, and nothing is
+ * programmed at all if the value is unchanged.
+ *
+ * @param field is the field to write (META_*).
+ * @param value is the new value of the field.
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_write(uint32_t field, uint32_t value)
+{
+    // Save an EEPROM write if nothing changed
+    if (meta_cache[field] == value) {
+        return 0;
+    }
+
+    meta_cache[field] = value;
+    if (MAP_EEPROMProgram(&meta_cache[field], METADATA_EEPROM_PTR + (field << 2), 4) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Set boot flags in the metadata record.
+ *
+ * @param flags is the set of flags to set (META_FLAG_*).
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_set_flags(uint32_t flags)
+{
+    return metadata_write(META_FLAGS, meta_cache[META_FLAGS] | flags);
+}
+
+/**
+ * @brief Clear boot flags in the metadata record.
+ *
+ * @param flags is the set of flags to clear (META_FLAG_*).
+ * @return 0 on success, or -1 if the EEPROM could not be programmed.
+ */
+int32_t metadata_clear_flags(uint32_t flags)
+{
+    return metadata_write(META_FLAGS, meta_cache[META_FLAGS] & ~flags);
+}
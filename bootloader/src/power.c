@@ -0,0 +1,174 @@
+/**
+ * @file power.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Low-power waits for the host UART and the flash controller.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/flash.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/timer.h"
+#include "driverlib/uart.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "power.h"
+#include "uart.h"
+
+// Whether interrupts were already masked before power_init()
+static bool power_was_masked;
+
+#ifdef POWER_STATS
+// Sleep time counters, in ticks of the free-running timer
+static uint64_t power_asleep;
+static uint64_t power_total;
+static uint32_t power_last;
+
+/**
+ * @brief Bring the total time up to date.
+ *
+ * @return the number of ticks since the last call.
+ */
+static uint32_t power_update(void)
+{
+    uint32_t now = MAP_TimerValueGet(TIMER0_BASE, TIMER_A);
+    // The timer counts down through the full 32 bits, so this also works across a wrap
+    uint32_t delta = power_last - now;
+
+    power_last = now;
+    power_total += delta;
+    return delta;
+}
+#endif
+
+/**
+ * @brief Clear every wakeup source so the next sleep does not return at once.
+ */
+static void power_clear(void)
+{
+    // Peripheral first, otherwise the NVIC pends it again straight away
+    MAP_UARTIntClear(HOST_UART, UART_INT_RX | UART_INT_RT);
+    MAP_IntPendClear(INT_UART0);
+
+    MAP_FlashIntClear(FLASH_INT_PROGRAM);
+    MAP_IntPendClear(INT_FLASH);
+
+#ifdef POWER_STATS
+    MAP_TimerIntClear(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_IntPendClear(INT_TIMER0A);
+#endif
+}
+
+/**
+ * @brief Set up the interrupts that wake the core from sleep.
+ *
+ * Must be called after uart_init().
+ */
+void power_init(void)
+{
+    // Interrupts only wake the core, they are never taken
+    power_was_masked = MAP_IntMasterDisable();
+
+    // Receive interrupt once a few characters are waiting, or as soon as the
+    // line goes idle with fewer (receive timeout)
+    MAP_UARTFIFOLevelSet(HOST_UART, UART_FIFO_TX4_8, UART_FIFO_RX1_8);
+    MAP_UARTIntEnable(HOST_UART, UART_INT_RX | UART_INT_RT);
+    MAP_IntEnable(INT_UART0);
+
+    // Flash controller interrupt when a program or erase completes
+    MAP_FlashIntEnable(FLASH_INT_PROGRAM);
+    MAP_IntEnable(INT_FLASH);
+
+#ifdef POWER_STATS
+    // Free-run TIMER0 at the system clock. It keeps counting while the core
+    // sleeps, unlike the DWT cycle counter. Its timeout wakes us once per wrap
+    // so no wrap is ever missed.
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER0);
+    while (!MAP_SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER0));
+    MAP_TimerConfigure(TIMER0_BASE, TIMER_CFG_PERIODIC);
+    MAP_TimerLoadSet(TIMER0_BASE, TIMER_A, 0xFFFFFFFF);
+    MAP_TimerIntEnable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_IntEnable(INT_TIMER0A);
+    MAP_TimerEnable(TIMER0_BASE, TIMER_A);
+    power_last = MAP_TimerValueGet(TIMER0_BASE, TIMER_A);
+#endif
+
+    power_clear();
+}
+
+/**
+ * @brief Sleep until the host UART receives data or a flash operation completes.
+ *
+ * Callers sleep in a loop until whatever they wait for is done, as the core
+ * also wakes for the other sources.
+ */
+void power_sleep(void)
+{
+#ifdef POWER_STATS
+    power_update();
+    MAP_SysCtlSleep();
+    power_asleep += power_update();
+#else
+    MAP_SysCtlSleep();
+#endif
+
+    power_clear();
+}
+
+/**
+ * @brief Put the interrupt setup back the way power_init() found it.
+ *
+ * Called right before jumping to the firmware so it does not start with
+ * stray wakeup sources enabled or pending.
+ */
+void power_restore(void)
+{
+    MAP_IntDisable(INT_UART0);
+    MAP_UARTIntDisable(HOST_UART, UART_INT_RX | UART_INT_RT);
+    MAP_IntDisable(INT_FLASH);
+    MAP_FlashIntDisable(FLASH_INT_PROGRAM);
+
+#ifdef POWER_STATS
+    MAP_IntDisable(INT_TIMER0A);
+    MAP_TimerDisable(TIMER0_BASE, TIMER_A);
+    MAP_TimerIntDisable(TIMER0_BASE, TIMER_TIMA_TIMEOUT);
+#endif
+
+    power_clear();
+
+#ifdef POWER_STATS
+    // Only once its interrupt is cleared, the registers are gone after this
+    MAP_SysCtlPeripheralDisable(SYSCTL_PERIPH_TIMER0);
+#endif
+
+    if (!power_was_masked) {
+        MAP_IntMasterEnable();
+    }
+}
+
+/**
+ * @brief Send the sleep time counters to the host and clear them.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void power_report(uint32_t uart)
+{
+#ifdef POWER_STATS
+    power_update();
+    uart_write(uart, (uint8_t *)&power_asleep, sizeof(power_asleep));
+    uart_write(uart, (uint8_t *)&power_total, sizeof(power_total));
+
+    // Start counting afresh for the next operation
+    power_asleep = 0;
+    power_total = 0;
+#endif
+}
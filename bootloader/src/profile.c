@@ -0,0 +1,179 @@
+/**
+ * @file profile.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Cycle counting for the phases of an update.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "inc/hw_memmap.h"
+#include "inc/hw_nvic.h"
+#include "inc/hw_types.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "load.h"
+#include "power.h"
+#include "profile.h"
+#include "uart.h"
+
+// DWT registers that the TivaWare headers do not define
+#define DWT_CTRL                (DWT_BASE + 0x000)
+#define DWT_CYCCNT              (DWT_BASE + 0x004)
+#define DWT_CTRL_CYCCNTENA      0x00000001
+#define NVIC_DBG_INT_TRCENA     0x01000000  // Enable DWT and ITM (DEMCR)
+
+// Per phase totals, laid out as they are sent to the host
+struct prof_phase {
+    uint32_t count;
+    uint32_t reserved;
+    uint64_t cycles;
+};
+
+static struct prof_phase prof_phases[PROF_NUM_PHASES];
+static uint8_t prof_src;
+static uint32_t prof_mask;
+
+/**
+ * @brief Start the cycle counter.
+ *
+ * Uses the DWT cycle counter if it runs, or SysTick if it does not.
+ */
+void profile_init(void)
+{
+    uint32_t start;
+    volatile uint32_t i;
+
+    // Turn on the DWT and its cycle counter
+    HWREG(NVIC_DBG_INT) |= NVIC_DBG_INT_TRCENA;
+    HWREG(DWT_CYCCNT) = 0;
+    HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+
+    // Give it a few cycles to prove it is counting
+    start = HWREG(DWT_CYCCNT);
+    for (i = 0; i < 16; i++);
+
+    if (HWREG(DWT_CYCCNT) != start) {
+        prof_src = PROF_SRC_DWT;
+        prof_mask = 0xFFFFFFFF;
+        return;
+    }
+
+    // No cycle counter (QEMU), free-run SysTick from the system clock instead
+    HWREG(NVIC_ST_CTRL) = 0;
+    HWREG(NVIC_ST_RELOAD) = 0x00FFFFFF;
+    HWREG(NVIC_ST_CURRENT) = 0;
+    HWREG(NVIC_ST_CTRL) = NVIC_ST_CTRL_CLK_SRC | NVIC_ST_CTRL_ENABLE;
+    prof_src = PROF_SRC_SYSTICK;
+    prof_mask = 0x00FFFFFF;
+}
+
+/**
+ * @brief Which timer the cycle counts come from.
+ *
+ * @return PROF_SRC_DWT or PROF_SRC_SYSTICK.
+ */
+uint8_t profile_source(void)
+{
+    return prof_src;
+}
+
+/**
+ * @brief Read the cycle counter.
+ *
+ * @return the current cycle count. Only differences between two counts are
+ * meaningful, see profile_elapsed().
+ */
+uint32_t profile_now(void)
+{
+    if (prof_src == PROF_SRC_DWT) {
+        return HWREG(DWT_CYCCNT);
+    }
+    // SysTick counts down
+    return prof_mask - HWREG(NVIC_ST_CURRENT);
+}
+
+/**
+ * @brief Cycles elapsed since an earlier profile_now().
+ *
+ * @param start is the earlier cycle count.
+ * @return the number of cycles since start, accounting for counter wrap.
+ */
+uint32_t profile_elapsed(uint32_t start)
+{
+    return (profile_now() - start) & prof_mask;
+}
+
+/**
+ * @brief Add one run of a phase to its totals.
+ *
+ * @param phase is the phase that ran (PROF_*).
+ * @param start is the cycle count when the phase started.
+ */
+void profile_record(uint32_t phase, uint32_t start)
+{
+    prof_phases[phase].cycles += profile_elapsed(start);
+    prof_phases[phase].count++;
+}
+
+/**
+ * @brief Send the phase totals to the host and clear them.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void profile_report(uint32_t uart)
+{
+    uint32_t i;
+    uint32_t clock = MAP_SysCtlClockGet();
+
+    uart_writeb(uart, PROF_REPORT_VERSION);
+#ifdef PROFILE
+    uart_writeb(uart, PROF_NUM_PHASES);
+#else
+    uart_writeb(uart, 0);
+#endif
+    uart_writeb(uart, prof_src);
+#ifdef POWER_STATS
+    uart_writeb(uart, PROF_REPORT_POWER | PROF_REPORT_FRAMES);
+#else
+    uart_writeb(uart, PROF_REPORT_FRAMES);
+#endif
+    uart_write(uart, (uint8_t *)&clock, sizeof(clock));
+
+#ifdef PROFILE
+    uart_write(uart, (uint8_t *)prof_phases, sizeof(prof_phases));
+#endif
+#ifdef POWER_STATS
+    power_report(uart);
+#endif
+    load_report(uart);
+
+    // Start counting afresh for the next operation
+    for (i = 0; i < PROF_NUM_PHASES; i++) {
+        prof_phases[i].count = 0;
+        prof_phases[i].cycles = 0;
+    }
+}
+
+/**
+ * @brief Get the size of the report profile_report() sends.
+ *
+ * @return the number of bytes in the report.
+ */
+uint32_t profile_report_size(void)
+{
+    uint32_t size = 8 + LOAD_REPORT_SIZE;
+
+#ifdef PROFILE
+    size += sizeof(prof_phases);
+#endif
+#ifdef POWER_STATS
+    size += POWER_REPORT_SIZE;
+#endif
+    return size;
+}
@@ -0,0 +1,77 @@
+/**
+ * @file queue.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Bounded FIFO queues for passing buffers between tasks.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "queue.h"
+
+/**
+ * @brief Empty a queue.
+ *
+ * @param q is the queue.
+ */
+void queue_init(struct queue *q)
+{
+    q->head = 0;
+    q->count = 0;
+}
+
+/**
+ * @brief Check if a queue is empty.
+ *
+ * @param q is the queue.
+ * @return true if there is nothing to take from the queue.
+ */
+bool queue_empty(struct queue *q)
+{
+    return q->count == 0;
+}
+
+/**
+ * @brief Check if a queue is full.
+ *
+ * @param q is the queue.
+ * @return true if there is no room for another item.
+ */
+bool queue_full(struct queue *q)
+{
+    return q->count == QUEUE_CAPACITY;
+}
+
+/**
+ * @brief Add an item to the back of a queue.
+ *
+ * The queue must not be full.
+ *
+ * @param q is the queue.
+ * @param item is the item to add.
+ */
+void queue_put(struct queue *q, void *item)
+{
+    q->items[(q->head + q->count) % QUEUE_CAPACITY] = item;
+    q->count++;
+}
+
+/**
+ * @brief Take the item at the front of a queue.
+ *
+ * The queue must not be empty.
+ *
+ * @param q is the queue.
+ * @return the oldest item in the queue.
+ */
+void *queue_get(struct queue *q)
+{
+    void *item = q->items[q->head];
+
+    q->head = (q->head + 1) % QUEUE_CAPACITY;
+    q->count--;
+    return item;
+}
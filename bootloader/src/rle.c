@@ -0,0 +1,72 @@
+/**
+ * @file rle.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Run-length encoding of readback data.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rle.h"
+#include "uart.h"
+
+/**
+ * @brief Count how many times the first byte of data repeats.
+ *
+ * @param data is the data.
+ * @param size is the number of bytes of data.
+ * @param max is the longest run to count.
+ * @return the length of the run, at least 1.
+ */
+static uint32_t rle_run(const uint8_t *data, uint32_t size, uint32_t max)
+{
+    uint32_t n = 1;
+
+    if (max > size) {
+        max = size;
+    }
+    while ((n < max) && (data[n] == data[0])) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Send data run-length encoded.
+ *
+ * @param uart is the base address of the UART port to write to.
+ * @param data is the data to send, read in place so it can be flash.
+ * @param size is the number of bytes of data.
+ * @return the number of bytes sent.
+ */
+uint32_t rle_send(uint32_t uart, const uint8_t *data, uint32_t size)
+{
+    uint32_t sent = 0;
+    uint32_t n;
+
+    while (size > 0) {
+        n = rle_run(data, size, RLE_MAX_RUN);
+        if (n >= RLE_MIN_RUN) {
+            uart_writeb(uart, RLE_RUN | ((n - 1) >> 8));
+            uart_writeb(uart, n - 1);
+            uart_writeb(uart, data[0]);
+            sent += 3;
+        } else {
+            // Literal up to the next run worth encoding
+            n = 0;
+            while ((n < size) && (n < RLE_MAX_LITERAL) &&
+                   (rle_run(data + n, size - n, RLE_MIN_RUN) < RLE_MIN_RUN)) {
+                n++;
+            }
+            uart_writeb(uart, n - 1);
+            uart_write(uart, (uint8_t *)data, n);
+            sent += 1 + n;
+        }
+        data += n;
+        size -= n;
+    }
+    return sent;
+}
@@ -0,0 +1,59 @@
+/**
+ * @file sched.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Cooperative scheduler for protothread-style tasks.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "power.h"
+#include "sched.h"
+#include "timeout.h"
+
+/**
+ * @brief Run a set of tasks until all of them are done.
+ *
+ * Tasks are called round robin, in the order given. Every task starts from
+ * the top.
+ *
+ * @param tasks is the set of tasks to run.
+ * @param num is the number of tasks.
+ */
+void sched_run(struct task *tasks, uint32_t num)
+{
+    uint32_t i;
+    uint32_t done;
+    bool progress;
+
+    for (i = 0; i < num; i++) {
+        tasks[i].resume = 0;
+        tasks[i].state = TASK_YIELDED;
+    }
+
+    do {
+        done = 0;
+        progress = false;
+
+        for (i = 0; i < num; i++) {
+            if (tasks[i].state != TASK_DONE) {
+                tasks[i].state = tasks[i].fn(&tasks[i]);
+                if (tasks[i].state != TASK_WAITING) {
+                    progress = true;
+                }
+            }
+            if (tasks[i].state == TASK_DONE) {
+                done++;
+            }
+        }
+
+        // Everyone is waiting on the hardware, so sleep until it has news
+        if (!progress) {
+            timeout_check();
+            power_sleep();
+        }
+    } while (done < num);
+}
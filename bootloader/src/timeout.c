@@ -0,0 +1,142 @@
+/**
+ * @file timeout.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Read deadlines that abort a command when the host goes quiet.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "inc/hw_ints.h"
+#include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "driverlib/interrupt.h"
+#include "driverlib/sysctl.h"
+#include "driverlib/timer.h"
+#include "driverlib/watchdog.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "timeout.h"
+#include "trace.h"
+
+jmp_buf timeout_env;
+
+static const uint32_t timeout_ms[TIMEOUT_NUM_PHASES] = {
+    TIMEOUT_COMMAND_MS,
+    TIMEOUT_FRAME_MS,
+};
+
+static uint32_t timeout_ticks_per_ms;
+static bool timeout_armed;
+static uint32_t timeout_phase;
+
+/**
+ * @brief Stop the deadline timer and clear its timeout.
+ */
+static void timeout_disarm(void)
+{
+    MAP_TimerDisable(TIMER1_BASE, TIMER_A);
+    MAP_TimerIntClear(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_IntPendClear(INT_TIMER1A);
+    timeout_armed = false;
+}
+
+/**
+ * @brief Set up the deadline timer and start the watchdog.
+ */
+void timeout_init(void)
+{
+    timeout_ticks_per_ms = MAP_SysCtlClockGet() / 1000;
+
+    // One-shot deadline timer. Its interrupt is never taken, but wakes the
+    // core so a sleeping uart_readb() notices the deadline.
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_TIMER1);
+    while (!MAP_SysCtlPeripheralReady(SYSCTL_PERIPH_TIMER1));
+    MAP_TimerConfigure(TIMER1_BASE, TIMER_CFG_ONE_SHOT);
+    MAP_TimerIntEnable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    MAP_IntEnable(INT_TIMER1A);
+    timeout_disarm();
+
+    // Watchdog: the first period raises its interrupt, which wakes an idle
+    // command loop to feed it, the second resets the device
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_WDOG0);
+    while (!MAP_SysCtlPeripheralReady(SYSCTL_PERIPH_WDOG0));
+    MAP_WatchdogReloadSet(WATCHDOG0_BASE, TIMEOUT_WATCHDOG_MS * timeout_ticks_per_ms);
+    MAP_WatchdogResetEnable(WATCHDOG0_BASE);
+    MAP_WatchdogEnable(WATCHDOG0_BASE);
+    MAP_IntEnable(INT_WATCHDOG);
+}
+
+/**
+ * @brief Start the deadline of a phase, replacing any earlier one.
+ *
+ * @param phase is the phase that starts (TIMEOUT_*).
+ */
+void timeout_start(uint32_t phase)
+{
+    timeout_disarm();
+    MAP_TimerLoadSet(TIMER1_BASE, TIMER_A, timeout_ms[phase] * timeout_ticks_per_ms);
+    MAP_TimerEnable(TIMER1_BASE, TIMER_A);
+    timeout_phase = phase;
+    timeout_armed = true;
+
+    timeout_feed();
+}
+
+/**
+ * @brief Stop the current deadline, if any.
+ */
+void timeout_stop(void)
+{
+    timeout_disarm();
+}
+
+/**
+ * @brief Abandon the command if its deadline has passed.
+ *
+ * Does not return in that case, but jumps back to timeout_env. Otherwise it
+ * feeds the watchdog.
+ */
+void timeout_check(void)
+{
+    if (timeout_armed && (MAP_TimerIntStatus(TIMER1_BASE, false) & TIMER_TIMA_TIMEOUT)) {
+        timeout_disarm();
+        trace_event(TRACE_TIMEOUT, timeout_phase);
+        longjmp(timeout_env, 1);
+    }
+
+    timeout_feed();
+}
+
+/**
+ * @brief Feed the watchdog.
+ */
+void timeout_feed(void)
+{
+    // Clearing the interrupt also reloads the counter
+    MAP_WatchdogIntClear(WATCHDOG0_BASE);
+    MAP_IntPendClear(INT_WATCHDOG);
+}
+
+/**
+ * @brief Stop the deadline timer and the watchdog reset before booting the firmware.
+ *
+ * The watchdog itself cannot be stopped once it runs, so it is left counting
+ * with its reset and its interrupt disabled.
+ */
+void timeout_release(void)
+{
+    MAP_IntDisable(INT_TIMER1A);
+    MAP_TimerIntDisable(TIMER1_BASE, TIMER_TIMA_TIMEOUT);
+    timeout_disarm();
+    MAP_SysCtlPeripheralDisable(SYSCTL_PERIPH_TIMER1);
+
+    MAP_IntDisable(INT_WATCHDOG);
+    MAP_WatchdogResetDisable(WATCHDOG0_BASE);
+    timeout_feed();
+}
@@ -0,0 +1,85 @@
+/**
+ * @file trace.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Timestamped event trace kept in an SRAM ring.
+ * @date 2022
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "driverlib/sysctl.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
+
+#include "profile.h"
+#include "trace.h"
+#include "uart.h"
+
+// One event, laid out as it is sent to the host
+struct trace_entry {
+    uint32_t time;
+    uint16_t event;
+    uint16_t arg;
+};
+
+static struct trace_entry trace_ring[TRACE_NUM_ENTRIES];
+static uint32_t trace_head;     // next entry to write
+static uint32_t trace_count;    // valid entries, up to TRACE_NUM_ENTRIES
+
+/**
+ * @brief Record an event in the trace.
+ *
+ * Once the ring is full the oldest event is overwritten.
+ *
+ * @param event is the event that happened (TRACE_*).
+ * @param arg is the event argument.
+ */
+void trace_event(uint16_t event, uint16_t arg)
+{
+    trace_ring[trace_head].time = profile_now();
+    trace_ring[trace_head].event = event;
+    trace_ring[trace_head].arg = arg;
+
+    trace_head = (trace_head + 1) % TRACE_NUM_ENTRIES;
+    if (trace_count < TRACE_NUM_ENTRIES) {
+        trace_count++;
+    }
+}
+
+/**
+ * @brief Send the trace to the host, oldest event first.
+ *
+ * The trace is left in place.
+ *
+ * @param uart is the base address of the UART port to write to.
+ */
+void trace_dump(uint32_t uart)
+{
+    uint32_t i;
+    uint32_t clock = MAP_SysCtlClockGet();
+    uint32_t count = trace_count;
+    uint32_t tail = (trace_head + TRACE_NUM_ENTRIES - count) % TRACE_NUM_ENTRIES;
+
+    uart_writeb(uart, TRACE_DUMP_VERSION);
+    uart_writeb(uart, profile_source());
+    uart_writeb(uart, count);
+    uart_writeb(uart, count >> 8);
+    uart_write(uart, (uint8_t *)&clock, sizeof(clock));
+
+    for (i = 0; i < count; i++) {
+        uart_write(uart, (uint8_t *)&trace_ring[(tail + i) % TRACE_NUM_ENTRIES], sizeof(struct trace_entry));
+    }
+}
+
+/**
+ * @brief Get the size of the dump trace_dump() sends.
+ *
+ * @return the number of bytes in the dump.
+ */
+uint32_t trace_dump_size(void)
+{
+    return 8 + trace_count * sizeof(struct trace_entry);
+}
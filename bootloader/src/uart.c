@@ -23,9 +23,18 @@
 #include "driverlib/pin_map.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/uart.h"
+#include "driverlib/rom.h"
+#include "driverlib/rom_map.h"
 
+#include "power.h"
+#include "profile.h"
+#include "timeout.h"
 #include "uart.h"
 
+// Running Fletcher-16, see uart_sum_start()
+static uint32_t uart_sum1;
+static uint32_t uart_sum2;
+
 
 /**
  * @brief Initialize the UART interfaces.
@@ -37,12 +46,12 @@ void uart_init(void)
 {
     // Configure the UART peripherals used in this example
     // RCGC   Run Mode Clock Gating
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);  // UART 0 for host interface
-    SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA);  // UART 0 is on GPIO Port A
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_UART0);  // UART 0 for host interface
+    MAP_SysCtlPeripheralEnable(SYSCTL_PERIPH_GPIOA);  // UART 0 is on GPIO Port A
     // HBCTL  High-performance Bus Control
     // PCTL   Port Control
-    GPIOPinConfigure(GPIO_PA0_U0RX);
-    GPIOPinConfigure(GPIO_PA1_U0TX);
+    MAP_GPIOPinConfigure(GPIO_PA0_U0RX);
+    MAP_GPIOPinConfigure(GPIO_PA1_U0TX);
     // DIR    Direction
     // AFSEL  Alternate Function Select 
     // DR2R   2-mA Drive Select
@@ -54,11 +63,11 @@ void uart_init(void)
     // PDR    Pull-Down Select
     // DEN    Digital Enable
     // AMSEL  Analog Mode Select
-    GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
+    MAP_GPIOPinTypeUART(GPIO_PORTA_BASE, GPIO_PIN_0 | GPIO_PIN_1);
 
     // Configure the UARTs for 115,200, 8-N-1 operation.
-    UARTConfigSetExpClk(UART0_BASE, SysCtlClockGet(), 115200,
-                        (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
+    MAP_UARTConfigSetExpClk(UART0_BASE, MAP_SysCtlClockGet(), 115200,
+                            (UART_CONFIG_WLEN_8 | UART_CONFIG_STOP_ONE | UART_CONFIG_PAR_NONE));
 }
 
 
@@ -71,19 +80,32 @@ void uart_init(void)
  */
 bool uart_avail(uint32_t interface)
 {
-    return UARTCharsAvail(interface);
+    return MAP_UARTCharsAvail(interface);
 }
 
 
 /**
  * @brief Read a byte from a UART interface.
  * 
+ * Sleeps until a byte arrives. Only the host UART wakes the core, see power.h.
+ * Does not return if the current deadline passes first, see timeout.h.
+ * 
  * @param uart is the base address of the UART port to read from.
  * @return the character read from the interface.
  */
 int32_t uart_readb(uint32_t uart)
 {
-    return UARTCharGet(uart);
+    int32_t data;
+
+    while (!MAP_UARTCharsAvail(uart)) {
+        timeout_check();
+        power_sleep();
+    }
+    data = MAP_UARTCharGetNonBlocking(uart);
+
+    uart_sum1 = (uart_sum1 + (uint8_t)data) % 255;
+    uart_sum2 = (uart_sum2 + uart_sum1) % 255;
+    return data;
 }
 
 
@@ -99,9 +121,11 @@ uint32_t uart_read(uint32_t uart, uint8_t *buf, uint32_t n)
 {
     uint32_t read;
 
+    PROFILE_BEGIN(PROF_UART_READ);
     for (read = 0; read < n; read++) {
         buf[read] = (uint8_t)uart_readb(uart);
     }
+    PROFILE_END(PROF_UART_READ);
     return read;
 }
 
@@ -141,7 +165,11 @@ uint32_t uart_readline(uint32_t uart, uint8_t *buf)
  */
 void uart_writeb(uint32_t uart, uint8_t data)
 {
-    UARTCharPut(uart, data);
+    MAP_UARTCharPut(uart, data);
+    timeout_feed();
+
+    uart_sum1 = (uart_sum1 + data) % 255;
+    uart_sum2 = (uart_sum2 + uart_sum1) % 255;
 }
 
 
@@ -163,3 +191,27 @@ uint32_t uart_write(uint32_t uart, uint8_t *buf, uint32_t len)
 
     return i;
 }
+
+
+/**
+ * @brief Start a running Fletcher-16 of the bytes read and written.
+ * 
+ * Every byte that goes through uart_readb() or uart_writeb() after this is
+ * added to it. Used to checksum frames, see frame.h.
+ */
+void uart_sum_start(void)
+{
+    uart_sum1 = 0;
+    uart_sum2 = 0;
+}
+
+
+/**
+ * @brief Get the running Fletcher-16 of the bytes read and written.
+ * 
+ * @return the checksum of the bytes since uart_sum_start().
+ */
+uint16_t uart_sum(void)
+{
+    return (uint16_t)((uart_sum2 << 8) | uart_sum1);
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/python3 -u
+
+# 2022 eCTF
+# Bootloader Stack Report
+# 0xDACC
+#
+# Works out the worst-case stack depth of a linked bootloader, to check it against _STACK_SIZE in
+# bootloader.ld. Run through `make stack`, which every build runs once the image is linked (and as part
+# of `make report`).
+# Each function's own frame comes from the .su files GCC writes with -fstack-usage, and the call graph
+# from the disassembly. The scheduler calls its tasks through function pointers, so it is assumed to
+# reach every task (functions named *_task, see inc/sched.h). Other calls through pointers are the
+# MAP_ calls into the driverlib ROM. Functions without stack usage info (libdriver, libc and the ROM)
+# are counted as 0 and listed, so their frames have to be allowed for by hand.
+
+import argparse
+from pathlib import Path
+import re
+import subprocess
+
+ENTRY = "Bootloader_Startup"
+
+# Functions that run the scheduled tasks: sched_run, or what it is inlined into
+TASK_CALLERS = {"sched_run", "load_data"}
+
+FUNC_RE = re.compile(r"^[0-9a-f]+ <([^>]+)>:$")
+CALL_RE = re.compile(r"\s(bl|blx|b|b\.n|b\.w)\s+[0-9a-f]+ <([^>+]+)>")
+INDIRECT_RE = re.compile(r"\sblx\s+r\d+")
+
+
+def frame_sizes(out_dir: Path) -> dict:
+    """Own stack frame of each function, from the -fstack-usage files."""
+    sizes = {}
+    for su in out_dir.glob("*.su"):
+        for line in su.read_text().splitlines():
+            fields = line.split("\t")
+            if len(fields) < 2:
+                continue
+            name = fields[0].rsplit(":", 1)[-1]
+            sizes[name] = max(sizes.get(name, 0), int(fields[1]))
+    return sizes
+
+
+def call_graph(objdump: str, axf: Path) -> (dict, set):
+    """Direct callees of each function, and the functions that call through pointers."""
+    out = subprocess.run(
+        [objdump, "-d", "--no-show-raw-insn", str(axf)], capture_output=True, check=True
+    ).stdout.decode()
+
+    calls = {}
+    indirect = set()
+    func = None
+    for line in out.splitlines():
+        match = FUNC_RE.match(line)
+        if match:
+            func = match.group(1)
+            calls.setdefault(func, set())
+            continue
+        if func is None:
+            continue
+        match = CALL_RE.search(line)
+        if match and match.group(2) != func:
+            calls[func].add(match.group(2))
+        elif INDIRECT_RE.search(line):
+            indirect.add(func)
+
+    tasks = {f for f in calls if f.split(".")[0].endswith("_task")}
+    for func in indirect:
+        if func.split(".")[0] in TASK_CALLERS:
+            calls[func] |= tasks
+    return calls, indirect
+
+
+def symbol_values(nm: str, axf: Path) -> dict:
+    """Value and size of each symbol."""
+    out = subprocess.run(
+        [nm, "-S", str(axf)], capture_output=True, check=True
+    ).stdout.decode()
+
+    symbols = {}
+    for line in out.splitlines():
+        fields = line.split()
+        if len(fields) == 4:
+            symbols[fields[3]] = (int(fields[0], 16), int(fields[1], 16))
+        elif len(fields) == 3:
+            symbols[fields[2]] = (int(fields[0], 16), 0)
+    return symbols
+
+
+def worst_path(calls: dict, sizes: dict, entry: str) -> (int, list, set):
+    """Deepest call chain from entry, its depth, and the functions on the way without a frame size."""
+    memo = {}
+    unknown = set()
+
+    def depth(func: str, stack: tuple):
+        if func in memo:
+            return memo[func]
+        if func in stack:
+            raise RuntimeError(f"recursion through {func}, stack depth is unbounded")
+        if func not in sizes:
+            unknown.add(func)
+        best, best_path = 0, []
+        for callee in sorted(calls.get(func, ())):
+            d, p = depth(callee, stack + (func,))
+            if d > best:
+                best, best_path = d, p
+        memo[func] = (sizes.get(func, 0) + best, [func] + best_path)
+        return memo[func]
+
+    total, path = depth(entry, ())
+    return total, path, unknown
+
+
+def stack_usage(axf: Path, objdump: str, nm: str) -> dict:
+    sizes = frame_sizes(axf.parent)
+    calls, indirect = call_graph(objdump, axf)
+    symbols = symbol_values(nm, axf)
+
+    entry = ENTRY if ENTRY in calls else "main"
+    peak, path, unknown = worst_path(calls, sizes, entry)
+
+    return {
+        "peak": peak,
+        "path": [(f, sizes.get(f)) for f in path],
+        "stack_size": symbols.get("_STACK_SIZE", (0, 0))[0],
+        "arena": symbols.get("arena", (0, 0))[1],
+        "unknown": sorted(unknown),
+        "indirect": sorted(indirect),
+    }
+
+
+def stack_lines(usage: dict) -> list:
+    lines = [
+        f"- worst-case stack: {usage['peak']} bytes of {usage['stack_size']} "
+        f"({usage['stack_size'] - usage['peak']} bytes headroom)",
+        f"- handler arena: {usage['arena']} bytes",
+        "- deepest path: "
+        + " -> ".join(f"{f} ({'?' if s is None else s})" for f, s in usage["path"]),
+    ]
+    if usage["indirect"]:
+        lines.append(f"- calls through pointers in: {', '.join(usage['indirect'])}")
+    if usage["unknown"]:
+        lines.append(f"- no stack usage info for: {', '.join(usage['unknown'])}")
+    return lines
+
+
+def main():
+    parser = argparse.ArgumentParser()
+
+    parser.add_argument("axf", help="The linked bootloader.", type=Path)
+    parser.add_argument(
+        "--objdump", help="The binutils objdump program to use.", default="arm-none-eabi-objdump"
+    )
+    parser.add_argument(
+        "--nm", help="The binutils nm program to use.", default="arm-none-eabi-nm"
+    )
+    parser.add_argument(
+        "--margin",
+        help="Bytes of _STACK_SIZE to keep free beyond the worst case, for the frames counted as 0.",
+        type=int,
+        default=0,
+    )
+
+    args = parser.parse_args()
+
+    usage = stack_usage(args.axf, args.objdump, args.nm)
+    print("\n".join(stack_lines(usage)))
+
+    if usage["peak"] + args.margin > usage["stack_size"]:
+        exit(
+            f"ERROR: worst-case stack of {usage['peak']} bytes plus a {args.margin} byte margin "
+            f"does not fit _STACK_SIZE ({usage['stack_size']} bytes)"
+        )
+
+
+if __name__ == "__main__":
+    main()
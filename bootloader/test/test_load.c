@@ -0,0 +1,316 @@
+/**
+ * @file test_load.c
+ * @author 0xDACC Team (github.com/0xDACC)
+ * @brief Host-side test of the data phase in load.c.
+ * @date 2022
+ *
+ * Runs load_data() on the host against a fake UART and flash, with the data
+ * a host would send, and checks what ends up in flash and what the host is
+ * answered. Built and run with `make test`.
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "load.h"
+#include "power.h"
+#include "timeout.h"
+#include "trace.h"
+#include "uart.h"
+
+#include "driverlib/sw_crc.h"
+
+#define TEST_UART       0
+#define TEST_BASE       0x10000
+#define TEST_PAGES      8
+
+struct arena arena;
+
+// Fake flash, TEST_PAGES pages from TEST_BASE
+static uint8_t flash[TEST_PAGES * FLASH_PAGE_SIZE];
+
+// What the host sent and what it was answered
+static uint8_t host_tx[16 * FLASH_PAGE_SIZE];
+static uint32_t host_tx_len;
+static uint32_t host_tx_pos;
+static uint8_t host_rx[64];
+static uint32_t host_rx_len;
+
+// Scheduler rounds in a row without progress
+static uint32_t stalls;
+
+static int failures;
+
+#define CHECK(cond, ...)                                    \
+    do {                                                    \
+        if (!(cond)) {                                      \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);     \
+            printf(__VA_ARGS__);                            \
+            printf("\n");                                   \
+            failures++;                                     \
+        }                                                   \
+    } while (0)
+
+bool uart_avail(uint32_t uart)
+{
+    (void)uart;
+    return host_tx_pos < host_tx_len;
+}
+
+int32_t uart_readb(uint32_t uart)
+{
+    (void)uart;
+    stalls = 0;
+    return host_tx[host_tx_pos++];
+}
+
+void uart_writeb(uint32_t uart, uint8_t data)
+{
+    (void)uart;
+    if (host_rx_len < sizeof(host_rx)) {
+        host_rx[host_rx_len] = data;
+    }
+    host_rx_len++;
+}
+
+uint32_t uart_write(uint32_t uart, uint8_t *buf, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        uart_writeb(uart, buf[i]);
+    }
+    return len;
+}
+
+int32_t flash_erase_page(uint32_t addr)
+{
+    memset(flash + (addr - TEST_BASE), 0xFF, FLASH_PAGE_SIZE);
+    return 0;
+}
+
+int32_t flash_write(uint32_t *data, uint32_t addr, uint32_t count)
+{
+    memcpy(flash + (addr - TEST_BASE), data, count * 4);
+    return 0;
+}
+
+void timeout_start(uint32_t phase)
+{
+    (void)phase;
+}
+
+void timeout_check(void)
+{
+    // Everything is waiting on the host, which has nothing more to send
+    if (++stalls > 1000) {
+        printf("FAIL: the data phase stalled after %u of %u bytes\n", host_tx_pos, host_tx_len);
+        exit(1);
+    }
+}
+
+void power_sleep(void)
+{
+}
+
+void trace_event(uint16_t event, uint16_t arg)
+{
+    (void)event;
+    (void)arg;
+}
+
+/**
+ * @brief Fill the image with a pattern that tells each byte's place apart.
+ */
+static void make_image(uint8_t *image, uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; i++) {
+        image[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+}
+
+/**
+ * @brief Queue bytes for the device to read.
+ */
+static void host_send(const uint8_t *data, uint32_t len)
+{
+    memcpy(host_tx + host_tx_len, data, len);
+    host_tx_len += len;
+}
+
+/**
+ * @brief Queue a checked frame, as host_tools/util.py pack_data_frame() does.
+ */
+static void host_send_checked(uint16_t index, const uint8_t *image, uint32_t size, uint32_t frame_size,
+                              bool corrupt)
+{
+    uint8_t frame[2 + LOAD_MAX_FRAME_SIZE + 4];
+    uint32_t offset = index * frame_size;
+    uint32_t len = size - offset < frame_size ? size - offset : frame_size;
+    uint32_t crc;
+
+    frame[0] = index;
+    frame[1] = index >> 8;
+    memset(frame + 2, 0xFF, frame_size);
+    memcpy(frame + 2, image + offset, len);
+    crc = Crc32(0xFFFFFFFF, frame, 2 + frame_size) ^ 0xFFFFFFFF;
+    if (corrupt) {
+        crc ^= 1;
+    }
+    memcpy(frame + 2 + frame_size, &crc, 4);
+    host_send(frame, 2 + frame_size + 4);
+}
+
+/**
+ * @brief Run the data phase over what the host has queued.
+ */
+static void run(uint32_t size, uint32_t frame_size, bool checked)
+{
+    memset(flash, 0, sizeof(flash));
+    load_erase(TEST_BASE, size);
+    host_rx_len = 0;
+    host_tx_pos = 0;
+    stalls = 0;
+
+    load_set_frame_size(frame_size);
+    load_data(TEST_UART, TEST_BASE, size, checked);
+    load_set_frame_size(FLASH_PAGE_SIZE);
+}
+
+/**
+ * @brief Check that flash holds the image, with the rest of its last page erased.
+ */
+static void check_flash(const char *name, const uint8_t *image, uint32_t size)
+{
+    uint32_t i;
+    uint32_t end = (size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE;
+
+    CHECK(memcmp(flash, image, size) == 0, "%s: flash does not hold the image", name);
+    for (i = size; i < end; i++) {
+        if (flash[i] != 0xFF) {
+            CHECK(false, "%s: byte %u after the image is 0x%02x, not erased", name, i, flash[i]);
+            break;
+        }
+    }
+    CHECK(host_tx_pos == host_tx_len, "%s: %u of %u bytes were read", name, host_tx_pos, host_tx_len);
+}
+
+/**
+ * @brief Count the FRAME_OK acks in what the host was answered.
+ */
+static uint32_t acks(void)
+{
+    uint32_t i;
+    uint32_t n = 0;
+
+    for (i = 0; i < host_rx_len; i++) {
+        n += host_rx[i] == FRAME_OK;
+    }
+    return n;
+}
+
+/**
+ * @brief A host from before the checked frames sends raw pages, the last one short.
+ */
+static void test_legacy(void)
+{
+    static uint8_t image[2500];
+
+    make_image(image, sizeof(image));
+    host_tx_len = 0;
+    host_send(image, FLASH_PAGE_SIZE);
+    host_send(image + FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+    host_send(image + 2 * FLASH_PAGE_SIZE, sizeof(image) - 2 * FLASH_PAGE_SIZE);
+
+    run(sizeof(image), FLASH_PAGE_SIZE, false);
+    check_flash("legacy", image, sizeof(image));
+    CHECK(host_rx_len == 3 && acks() == 3, "legacy: answered %u bytes, %u acks, expected 3 acks",
+          host_rx_len, acks());
+}
+
+/**
+ * @brief A host that asked for bigger frames with the legacy hello sends them raw too.
+ */
+static void test_legacy_frames(void)
+{
+    static uint8_t image[5000];
+
+    make_image(image, sizeof(image));
+    host_tx_len = 0;
+    host_send(image, sizeof(image));
+
+    run(sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+    check_flash("legacy frames", image, sizeof(image));
+    CHECK(host_rx_len == 3 && acks() == 3, "legacy frames: answered %u bytes, %u acks, expected 3 acks",
+          host_rx_len, acks());
+}
+
+/**
+ * @brief Checked frames: a bad frame is answered with FRAME_BAD and its number, and sent again.
+ */
+static void test_checked(void)
+{
+    static uint8_t image[3000];
+    uint32_t i;
+    bool bad = false;
+
+    make_image(image, sizeof(image));
+    host_tx_len = 0;
+    host_send_checked(0, image, sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+    host_send_checked(1, image, sizeof(image), LOAD_MAX_FRAME_SIZE, true);
+    host_send_checked(1, image, sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+
+    run(sizeof(image), LOAD_MAX_FRAME_SIZE, true);
+    check_flash("checked", image, sizeof(image));
+
+    // Two acks and FRAME_BAD for frame number 1, in some order
+    for (i = 0; i + 2 < host_rx_len; i++) {
+        if ((host_rx[i] == FRAME_BAD) && (host_rx[i + 1] == 1) && (host_rx[i + 2] == 0)) {
+            bad = true;
+        }
+    }
+    CHECK(host_rx_len == 5 && bad, "checked: answered %u bytes, expected two acks and FRAME_BAD 1",
+          host_rx_len);
+}
+
+/**
+ * @brief Checked frames: a repeated index is acked, but the transfer waits for the missing one.
+ */
+static void test_checked_repeat(void)
+{
+    static uint8_t image[3000];
+
+    make_image(image, sizeof(image));
+    host_tx_len = 0;
+    host_send_checked(0, image, sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+    host_send_checked(0, image, sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+    host_send_checked(1, image, sizeof(image), LOAD_MAX_FRAME_SIZE, false);
+
+    run(sizeof(image), LOAD_MAX_FRAME_SIZE, true);
+    check_flash("checked repeat", image, sizeof(image));
+    CHECK(host_rx_len == 3 && acks() == 3, "checked repeat: answered %u bytes, %u acks, expected 3 acks",
+          host_rx_len, acks());
+}
+
+int main(void)
+{
+    test_legacy();
+    test_legacy_frames();
+    test_checked();
+    test_checked_repeat();
+
+    if (failures != 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("load: all checks passed\n");
+    return 0;
+}
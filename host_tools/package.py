@@ -0,0 +1,138 @@
+# 2022 eCTF
+# Protected Package Format
+# 0xDACC
+#
+# Binary container for protected firmware, replacing the hex-in-JSON files fw_protect used to write.
+# Hex doubles the size of everything and has to be parsed into memory before a byte is sent. The
+# binary package is mapped with mmap and each section is used in place as a memoryview.
+#
+# Layout, little endian:
+#
+#      header:  4s magic "SFPK", u16 format version, u16 number of sections N, u32 reserved,
+#               u32 total file size
+#      table:   N x { 4s tag, u32 offset, u32 size, u32 reserved }
+#      payload: the sections, each starting on a SECTION_ALIGN boundary, padded with zeros
+#
+# Firmware packages hold the encrypted version frame (VERS), the release message without a
+# terminator (RMSG) and the encrypted firmware with both password frames (FIRM). Tools still read the
+# old JSON files, and package_convert turns them into binary packages.
+
+import json
+import mmap
+from pathlib import Path
+import struct
+
+MAGIC = b"SFPK"
+FORMAT_VERSION = 1
+
+HEADER = struct.Struct("<4sHHII")
+SECTION = struct.Struct("<4sIII")
+
+# Payload alignment, a multiple of the AES block size
+SECTION_ALIGN = 64
+
+SECTION_VERSION = b"VERS"
+SECTION_MESSAGE = b"RMSG"
+SECTION_FIRMWARE = b"FIRM"
+
+
+def align(n: int) -> int:
+    return (n + SECTION_ALIGN - 1) // SECTION_ALIGN * SECTION_ALIGN
+
+
+def write_package(path: Path, sections: list):
+    """Write a package
+
+    Args:
+        path (Path): the file to write
+        sections (list): (tag, data) pairs, in the order they are to be stored
+    """
+    offset = align(HEADER.size + SECTION.size * len(sections))
+    table = b""
+    for tag, data in sections:
+        table += SECTION.pack(tag, offset, len(data), 0)
+        offset = align(offset + len(data))
+
+    with path.open("wb") as f:
+        f.write(HEADER.pack(MAGIC, FORMAT_VERSION, len(sections), 0, offset))
+        f.write(table)
+        for tag, data in sections:
+            f.write(b"\x00" * (align(f.tell()) - f.tell()))
+            f.write(data)
+        f.write(b"\x00" * (offset - f.tell()))
+
+
+def is_package(path: Path) -> bool:
+    """Whether a file is a binary package, rather than a legacy JSON one"""
+    with path.open("rb") as f:
+        return f.read(len(MAGIC)) == MAGIC
+
+
+class Package:
+    """A binary package mapped into memory. Sections are memoryviews of the mapping, so nothing is
+    copied until it is used"""
+
+    def __init__(self, path: Path):
+        with path.open("rb") as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        self.view = memoryview(self.map)
+
+        if len(self.view) < HEADER.size:
+            exit(f"ERROR: {path.name} is too short to be a package")
+        magic, version, num_sections, _, size = HEADER.unpack_from(self.view)
+        if magic != MAGIC:
+            exit(f"ERROR: {path.name} is not a package")
+        if version != FORMAT_VERSION:
+            exit(f"ERROR: {path.name} is package format {version}, not {FORMAT_VERSION}")
+        if size != len(self.view):
+            exit(f"ERROR: {path.name} is {len(self.view)} bytes, its header says {size}")
+
+        self.sections = {}
+        for i in range(num_sections):
+            pos = HEADER.size + i * SECTION.size
+            if pos + SECTION.size > size:
+                exit(f"ERROR: {path.name} has a truncated section table")
+            tag, offset, length, _ = SECTION.unpack_from(self.view, pos)
+            if offset % SECTION_ALIGN or offset + length > size:
+                exit(f"ERROR: Section {tag} of {path.name} is out of bounds")
+            self.sections[tag] = self.view[offset : offset + length]
+
+    def section(self, tag: bytes) -> memoryview:
+        if tag not in self.sections:
+            exit(f"ERROR: Package has no {tag.decode()} section")
+        return self.sections[tag]
+
+
+def load_firmware(path: Path) -> dict:
+    """Read a protected firmware file, binary or legacy JSON
+
+    Returns:
+        dict: "version_num" (bytes), "release_msg" (str) and "firmware" (a bytes-like object)
+    """
+    if is_package(path):
+        package = Package(path)
+        return {
+            "version_num": bytes(package.section(SECTION_VERSION)),
+            "release_msg": bytes(package.section(SECTION_MESSAGE)).decode(),
+            "firmware": package.section(SECTION_FIRMWARE),
+        }
+
+    with path.open("rb") as f:
+        data = json.load(f)
+    return {
+        "version_num": bytes.fromhex(data["version_num"]),
+        "release_msg": data["release_msg"],
+        "firmware": bytes.fromhex(data["firmware"]),
+    }
+
+
+def write_firmware(path: Path, version_num: bytes, release_msg: str, firmware: bytes):
+    """Write a protected firmware package"""
+    write_package(
+        path,
+        [
+            (SECTION_VERSION, version_num),
+            (SECTION_MESSAGE, release_msg.encode()),
+            (SECTION_FIRMWARE, firmware),
+        ],
+    )
@@ -9,10 +9,24 @@
 # 2022 MITRE eCTF competition, and may not meet MITRE standards for quality.
 # Use this code at your own risk!
 
+from collections import deque
+from contextlib import nullcontext
+from functools import lru_cache
+import hashlib
+import importlib.machinery
+import importlib.util
 import logging
 from pathlib import Path
+import select
 import socket
+import struct
 from sys import stderr
+import weakref
+import zlib
+
+from Crypto.Cipher import AES
+
+from package import load_firmware
 
 LOG_FORMAT = "%(asctime)s:%(name)-12s%(levelname)-8s %(message)s"
 log = logging.getLogger(Path(__file__).name)
@@ -20,8 +34,77 @@ log = logging.getLogger(Path(__file__).name)
 CONFIGURATION_ROOT = Path("/configuration")
 FIRMWARE_ROOT = Path("/firmware")
 RELEASE_MESSAGES_ROOT = Path("/messages")
+SECRETS_ROOT = Path("/secrets")
 
 RESP_OK = b"\x00"
+RESP_BAD = b"\x01"
+
+# Bootloader flash page, the frame size unless a hello asks for bigger ones
+PAGE_SIZE = 0x400
+
+# Receive buffer of each connection, see Reader
+READER_BUF_SIZE = 4096
+
+# Hello reply: version, page buffers, largest frame size, features. See handle_hello() in the bootloader
+HELLO = struct.Struct("<BBHI")
+
+# Protocol features advertised in the hello reply (FEATURE_* in bootloader/src/bootloader.c)
+FEATURES = {
+    0x00000001: "stats",
+    0x00000002: "diagnostics",
+    0x00000004: "window",
+    0x00000008: "profile",
+    0x00000010: "power stats",
+    0x00000020: "frames",
+    0x00000040: "digest",
+    0x00000080: "readback rle",
+    0x00000100: "data crc",
+}
+
+# Framed commands, see bootloader/inc/frame.h
+FRAME_SOF = 0xA5
+FRAME_RESPONSE = 0x80
+FRAME_HEADER = struct.Struct("<BH")
+FRAME_CMD_BATCH = b"X"
+FRAME_MAX_PAYLOAD = 1280
+
+# Data frames: u16 index, data, u32 CRC32 of the two. See bootloader/inc/load.h
+DATA_INDEX = struct.Struct("<H")
+DATA_CRC = struct.Struct("<I")
+
+# Times a data frame is sent again after failing its CRC before giving up
+MAX_RESENDS = 5
+
+# Ranged readback flags (READBACK_FLAG_* in bootloader/src/bootloader.c)
+READBACK_FLAG_RLE = 0x01
+
+# Run-length encoded readback tokens, see bootloader/inc/rle.h
+RLE_RUN = 0x80
+
+# Digest algorithms of the 'V' command (DIGEST_* in bootloader/inc/digest.h)
+DIGESTS = {"crc32": 0, "sha256": 1}
+
+# Reason in a batch response for commands that did not run (BATCH_SKIPPED in bootloader.c)
+BATCH_SKIPPED = 0xFF
+
+# Why the bootloader refused something (TRACE_BAD_* in bootloader/inc/trace.h)
+BAD_REASONS = {
+    1: "version not signed with the password",
+    2: "version older than the installed one",
+    3: "first password frame did not decrypt correctly",
+    4: "decrypted last password frame is wrong",
+    5: "readback password is wrong",
+    6: "no complete firmware to boot",
+    7: "image does not fit its flash region",
+    8: "wrong payload length",
+    9: "frame checksum does not match",
+    10: "unknown command, or not allowed there",
+    11: "unknown readback region",
+    12: "data frame failed its CRC",
+    13: "unknown digest algorithm",
+    14: "installed firmware does not match its digest",
+    15: "unknown readback flags",
+}
 
 
 def print_banner(s: str) -> None:
@@ -36,28 +119,514 @@ def print_banner(s: str) -> None:
     print(banner, file=stderr)
 
 
+@lru_cache(maxsize=None)
+def read_secret(name: str) -> bytes:
+    """Read a host secret ("key", "iv" or "password"). Each is only read once per process, which
+    matters to the session daemon"""
+    path = SECRETS_ROOT / name
+    if not path.exists():
+        exit(f"ERROR: No {name} in {SECRETS_ROOT}")
+    return path.read_bytes()
+
+
+@lru_cache(maxsize=None)
+def load_tool(name: str):
+    """Load one of the host tools as a module, so that other tools can call its functions"""
+    loader = importlib.machinery.SourceFileLoader(name, str(Path(__file__).parent / name))
+    module = importlib.util.module_from_spec(importlib.util.spec_from_loader(name, loader))
+    loader.exec_module(module)
+    return module
+
+
+def connect(socket_number: int, sock: socket.socket = None):
+    """Connect to the bootloader, for use in a with statement
+
+    Args:
+        socket_number (int): the port of the bootloader on saffire-net
+        sock (socket.socket): a connection that is already open, which is used as it is and left
+            open afterwards (see the session tool)
+    """
+    if sock is not None:
+        return nullcontext(sock)
+    sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    sock.connect(("saffire-net", socket_number))
+    return sock
+
+
 class PacketIterator:
-    BLOCK_SIZE = 0x400
+    BLOCK_SIZE = PAGE_SIZE
 
-    def __init__(self, data: bytes):
+    def __init__(self, data: bytes, block_size: int = BLOCK_SIZE):
         self.data = data
         self.index = 0
         self.size = len(data)
+        self.block_size = block_size
 
     def __iter__(self):
         return [
-            self.data[i : i + self.BLOCK_SIZE]
-            for i in range(0, len(self.data), self.BLOCK_SIZE)
+            self.data[i : i + self.block_size]
+            for i in range(0, len(self.data), self.block_size)
         ].__iter__()
 
 
-def send_packets(sock: socket.socket, data: bytes):
-    packets = PacketIterator(data)
+class Reader:
+    """Buffered receive from a connection
+
+    Everything received goes into one buffer, reused for the life of the connection, with
+    recv_into. The reads below take what they need from it, so a whole response usually costs
+    one system call however many pieces it is read in. Everything read from a connection has
+    to go through its reader (see reader()), or what is already in the buffer would be missed.
+    """
+
+    def __init__(self, sock: socket.socket, size: int = READER_BUF_SIZE):
+        # The reader lives as long as the connection, and must not keep it open
+        self.sock = weakref.proxy(sock)
+        self.buf = bytearray(size)
+        self.view = memoryview(self.buf)
+        self.start = 0
+        self.end = 0
+
+    def buffered(self) -> int:
+        return self.end - self.start
+
+    def _recv_into(self, view: memoryview, timeout: float) -> int:
+        """One recv_into, exiting if the connection closes or nothing arrives within timeout
+        (None for the socket's own timeout)"""
+        old = self.sock.gettimeout()
+        if timeout is not None:
+            self.sock.settimeout(timeout)
+        try:
+            n = self.sock.recv_into(view)
+        except socket.timeout:
+            exit("ERROR: Timed out waiting for the bootloader")
+        finally:
+            if timeout is not None:
+                self.sock.settimeout(old)
+        if n == 0:
+            exit("ERROR: Connection to the bootloader closed")
+        return n
+
+    def _fill(self, timeout: float):
+        """Receive more into the buffer, making room for it first"""
+        if self.start == self.end:
+            self.start = self.end = 0
+        elif self.end == len(self.buf):
+            n = self.buffered()
+            if n == len(self.buf):
+                # Full of one unfinished read, so make it bigger
+                self.view.release()
+                self.buf.extend(bytes(len(self.buf)))
+                self.view = memoryview(self.buf)
+            else:
+                self.buf[:n] = self.buf[self.start : self.end]
+                self.start, self.end = 0, n
+        self.end += self._recv_into(self.view[self.end :], timeout)
+
+    def _take(self, n: int) -> bytes:
+        data = bytes(self.view[self.start : self.start + n])
+        self.start += n
+        return data
+
+    def recv_into(self, view: memoryview, timeout: float = None) -> int:
+        """Receive up to len(view) bytes into view, like socket.recv_into(). Reads of at least
+        a buffer's worth go straight into view when nothing is buffered"""
+        if not self.buffered():
+            if len(view) >= len(self.buf):
+                return self._recv_into(view, timeout)
+            self._fill(timeout)
+        n = min(len(view), self.buffered())
+        view[:n] = self.view[self.start : self.start + n]
+        self.start += n
+        return n
+
+    def read_exact(self, size: int, timeout: float = None) -> bytes:
+        """Receive exactly size bytes"""
+        if self.buffered() >= size:
+            return self._take(size)
+        data = bytearray(size)
+        view = memoryview(data)
+        got = 0
+        while got < size:
+            got += self.recv_into(view[got:], timeout)
+        return bytes(data)
+
+    def read_until(self, delim: bytes, timeout: float = None, max_size: int = None) -> bytes:
+        """Receive up to and including delim, and return what came before it"""
+        searched = 0  # how far into the buffered bytes there is no delimiter
+        while True:
+            pos = self.buf.find(delim, self.start + searched, self.end)
+            if pos >= 0:
+                data = self._take(pos - self.start)
+                self.start += len(delim)
+                return data
+            if max_size is not None and self.buffered() > max_size:
+                exit(f"ERROR: No {repr(delim)} in {self.buffered()} bytes from the bootloader")
+            # The delimiter may straddle what is here and what comes next
+            searched = max(0, self.buffered() - len(delim) + 1)
+            self._fill(timeout)
+
+    def discard(self) -> int:
+        """Throw away what is buffered and what has already arrived, without waiting for more
+
+        Returns:
+            int: the number of bytes thrown away. Raises ConnectionResetError if the connection
+                has closed.
+        """
+        n = self.buffered()
+        self.start = self.end = 0
+        while select.select([self.sock], [], [], 0)[0]:
+            got = self.sock.recv_into(self.view)
+            if got == 0:
+                raise ConnectionResetError("connection closed")
+            n += got
+        return n
+
+
+# The reader of each open connection
+_readers = weakref.WeakKeyDictionary()
+
+
+def reader(sock: socket.socket) -> Reader:
+    """The reader of a connection, made the first time it is read from"""
+    if sock not in _readers:
+        _readers[sock] = Reader(sock)
+    return _readers[sock]
+
+
+def recv_exact(sock: socket.socket, size: int, timeout: float = None) -> bytes:
+    """Receive exactly size bytes, or exit if the connection closes or times out"""
+    return reader(sock).read_exact(size, timeout)
+
+
+def recv_until(sock: socket.socket, delim: bytes, timeout: float = None) -> bytes:
+    """Receive up to and including delim and return what came before it, or exit if the
+    connection closes or times out"""
+    return reader(sock).read_until(delim, timeout)
+
+
+def parse_caps(data: bytes) -> dict:
+    """Decode the capabilities the bootloader sent in answer to a hello
+
+    Args:
+        data (bytes): the capabilities, followed by the agreed u16 frame size
+
+    Returns:
+        dict: the frame size and window to pass to send_packets(), and what the bootloader reported
+    """
+    version, buffers, max_frame_size, features = HELLO.unpack(data[: HELLO.size])
+    (frame_size,) = struct.unpack("<H", data[HELLO.size : HELLO.size + 2])
+
+    caps = {
+        "version": version,
+        "buffers": buffers,
+        "max_frame_size": max_frame_size,
+        "features": [name for bit, name in FEATURES.items() if features & bit],
+        "frame_size": frame_size,
+        # Each OK frees a frame's worth of page buffers
+        "window": max(1, buffers * PAGE_SIZE // frame_size),
+    }
+    log.info(
+        f"Bootloader takes {frame_size} byte frames, {caps['window']} at a time "
+        f"(features: {', '.join(caps['features']) or 'none'})"
+    )
+    return caps
+
+
+def fletcher16(data: bytes) -> int:
+    """Fletcher-16 checksum of a frame"""
+    sum1 = sum2 = 0
+    for byte in data:
+        sum1 = (sum1 + byte) % 255
+        sum2 = (sum2 + sum1) % 255
+    return (sum2 << 8) | sum1
+
+
+def pack_frame(cmd: bytes, payload: bytes = b"") -> bytes:
+    """Frame a command for the bootloader
+
+    Args:
+        cmd (bytes): the command, its legacy command byte or FRAME_CMD_BATCH
+        payload (bytes): the command payload
+
+    Returns:
+        bytes: the frame
+    """
+    if len(payload) > FRAME_MAX_PAYLOAD:
+        exit(f"ERROR: {len(payload)} byte payload does not fit in a frame")
+    body = FRAME_HEADER.pack(cmd[0], len(payload)) + payload
+    return bytes([FRAME_SOF]) + body + struct.pack("<H", fletcher16(body))
+
+
+def pack_batch(commands: list) -> bytes:
+    """Frame several commands as one batch
+
+    Args:
+        commands (list): (command, payload) pairs, run in order. A boot may only come last.
+
+    Returns:
+        bytes: the frame
+    """
+    payload = b"".join(cmd + struct.pack("<H", len(data)) + data for cmd, data in commands)
+    return pack_frame(FRAME_CMD_BATCH, payload)
+
+
+def recv_frame(sock: socket.socket, cmd: bytes) -> bytes:
+    """Receive the response to a framed command, and exit if the bootloader refused it
+
+    Args:
+        sock (socket.socket): the connection to the bootloader
+        cmd (bytes): the command answered
+
+    Returns:
+        bytes: the response data, after the status and reason
+    """
+    # Skip anything left over from before the response
+    recv_until(sock, bytes([FRAME_SOF]))
+
+    header = recv_exact(sock, FRAME_HEADER.size)
+    resp_cmd, length = FRAME_HEADER.unpack(header)
+    body = recv_exact(sock, length)
+    (check,) = struct.unpack("<H", recv_exact(sock, 2))
+
+    if check != fletcher16(header + body):
+        exit(f"ERROR: Response to {repr(cmd)} failed its checksum")
+    if resp_cmd != cmd[0] | FRAME_RESPONSE:
+        exit(f"ERROR: Expected the response to {repr(cmd)}, got {resp_cmd:#04x}")
+
+    status, reason = body[0], body[1]
+    if status != RESP_OK[0]:
+        exit(f"ERROR: Bootloader refused {repr(cmd)}: {BAD_REASONS.get(reason, f'reason {reason}')}")
+    return body[2:]
+
+
+def recv_batch(sock: socket.socket) -> list:
+    """Receive the combined response to a batch, and exit if any of its commands failed
+
+    Returns:
+        list: (command, status, reason) of each command in the batch
+    """
+    data = recv_frame(sock, FRAME_CMD_BATCH)
+    results = [tuple(data[i : i + 3]) for i in range(1, 1 + 3 * data[0], 3)]
+
+    for cmd, status, reason in results:
+        if status != RESP_OK[0]:
+            what = "skipped" if reason == BATCH_SKIPPED else BAD_REASONS.get(reason, f"reason {reason}")
+            exit(f"ERROR: Batched {repr(bytes([cmd]))} failed: {what}")
+    log.info(f"Batch of {len(results)} commands acknowledged")
+    return results
+
+
+def hello_command(frame_size: int = None) -> tuple:
+    """Framed hello asking for a frame size, or the largest the bootloader takes. Decode the
+    response with parse_caps()"""
+    return b"H", struct.pack("<H", 0xFFFF if frame_size is None else frame_size)
+
+
+def update_command(firmware_file: Path) -> (tuple, bytes):
+    """Framed update for a protected firmware file, binary or legacy JSON
 
-    for num, packet in enumerate(packets):
-        log.debug(f"Sending Packet {num} ({len(packet)} bytes)...")
-        sock.sendall(packet)
-        resp = sock.recv(1)  # Wait for an OK from the bootloader
+    Returns:
+        tuple, bytes: the command and payload, and the encrypted image for finish_transfer(), a
+            view of the mapped file for a binary package
+    """
+    data = load_firmware(firmware_file)
+    version_num = data["version_num"]
+    firmware = data["firmware"]
+
+    # Truncate release message if greater than 1k to stop any overflow bugs
+    release_msg = data["release_msg"][0:1024]
+
+    payload = (
+        version_num
+        + struct.pack(">I", len(firmware))
+        + bytes(firmware[0:16])
+        + release_msg.encode()
+        + b"\x00"
+    )
+    return (b"U", payload), firmware
+
+
+def configure_command(config_file: Path) -> (tuple, bytes):
+    """Framed configure for a protected configuration file
+
+    Returns:
+        tuple, bytes: the command and payload, and the encrypted image for finish_transfer()
+    """
+    configuration = config_file.read_bytes()
+    payload = struct.pack(">I", len(configuration)) + configuration[0:16]
+    return (b"C", payload), configuration
+
+
+def readback_command(region: str, size: int, offset: int = None, flags: int = 0) -> tuple:
+    """Framed readback of the firmware or configuration region
+
+    Args:
+        region (str): "firmware" or "configuration"
+        size (int): the number of bytes to read
+        offset (int): where to start within the region. Without one the readback starts at the
+            base of the region and is padded with 0xFF past its end, with one the whole range
+            must lie within the region.
+        flags (int): READBACK_FLAG_* for a ranged readback
+    """
+    password = read_secret("password")
+    region_id = b"F" if region == "firmware" else b"C"
+    payload = password + region_id + struct.pack(">I", size)
+    if offset is not None or flags:
+        payload += struct.pack(">I", offset or 0)
+    if flags:
+        payload += bytes([flags])
+    return b"R", payload
+
+
+def recv_rle(sock: socket.socket, size: int) -> (bytes, int):
+    """Receive and expand size bytes of run-length encoded readback data
+
+    Returns:
+        bytes, int: the data, and how many bytes came over the wire for it
+    """
+    data = bytearray()
+    received = 0
+    while len(data) < size:
+        (ctrl,) = recv_exact(sock, 1)
+        if ctrl & RLE_RUN:
+            count, value = recv_exact(sock, 2)
+            data += bytes([value]) * ((((ctrl & ~RLE_RUN) << 8) | count) + 1)
+            received += 3
+        else:
+            data += recv_exact(sock, ctrl + 1)
+            received += ctrl + 2
+    if len(data) != size:
+        exit(f"ERROR: Run-length encoded readback gave {len(data)} bytes, not {size}")
+    return bytes(data), received
 
-        if resp != RESP_OK:
+
+def digest_command(region: str, algorithm: str, offset: int, size: int) -> tuple:
+    """Framed digest of a range of the firmware or configuration region
+
+    Args:
+        region (str): "firmware" or "configuration"
+        algorithm (str): a key of DIGESTS
+        offset (int): where the range starts within the region
+        size (int): the number of bytes in the range
+    """
+    password = read_secret("password")
+    region_id = b"F" if region == "firmware" else b"C"
+    payload = (
+        password + region_id + bytes([DIGESTS[algorithm]]) + struct.pack(">II", offset, size)
+    )
+    return b"V", payload
+
+
+def local_digest(data: bytes, algorithm: str) -> bytes:
+    """The digest the bootloader's 'V' command gives for data"""
+    if algorithm == "crc32":
+        return zlib.crc32(data).to_bytes(4, "little")
+    return hashlib.sha256(data).digest()
+
+
+def installed_image(package: Path, region: str) -> bytes:
+    """What an update or configure with a protected package leaves in flash: the image decrypted,
+    without its two password frames"""
+    if region == "firmware":
+        image = load_firmware(package)["firmware"]
+    else:
+        image = package.read_bytes()
+
+    return AES.new(read_secret("key"), AES.MODE_CBC, read_secret("iv")).decrypt(image)[16:-16]
+
+
+def finish_transfer(sock: socket.socket, image: bytes, key_iv: bytes, caps: dict):
+    """Finish an update or configure once the bootloader has sent the key and IV
+
+    Args:
+        sock (socket.socket): the connection to the bootloader
+        image (bytes): the encrypted image
+        key_iv (bytes): the key and IV from the response to the command
+        caps (dict): the frame size and window agreed in the hello
+    """
+    # Decrypt
+    log.info("decrypting")
+    cip = AES.new(key_iv[:16], AES.MODE_CBC, key_iv[16:32])
+    dec = cip.decrypt(image)
+
+    # Send last password to bootloader to decide if this is a valid image
+    log.info("sending second password")
+    sock.sendall(dec[-16:])
+    wait_ok(sock)
+
+    # Send the image, not including the passwords
+    log.info("sending data")
+    send_packets(sock, dec[16:-16], window=caps["window"], block_size=caps["frame_size"])
+
+    # wait for bootloader to finish
+    log.info("waiting for bootloader to finish")
+    wait_ok(sock)
+
+
+def wait_ok(sock: socket.socket):
+    resp = recv_exact(sock, 1)  # Wait for an OK from the bootloader
+
+    if resp != RESP_OK:
+        exit(f"ERROR: Bootloader responded with {repr(resp)}")
+
+
+def pack_data_frame(index: int, packet: bytes, block_size: int) -> bytes:
+    """Build a data frame, padding the packet to the full frame size"""
+    body = DATA_INDEX.pack(index) + packet.ljust(block_size, b"\xff")
+    return body + DATA_CRC.pack(zlib.crc32(body))
+
+
+def send_packets(
+    sock: socket.socket, data: bytes, window: int = 1, block_size: int = PacketIterator.BLOCK_SIZE
+) -> int:
+    """Send data in indexed frames, each of which the bootloader acknowledges with an OK
+
+    A frame that fails its CRC on the way is answered with a bad response and the number of the
+    frame in the order sent instead, and only that frame is sent again.
+
+    Args:
+        sock (socket.socket): the connection to the bootloader
+        data (bytes): the data to send
+        window (int): how many frames may be waiting for their response at once.
+            Each response is a credit for one more frame.
+        block_size (int): the size of each frame, see hello_command()
+
+    Returns:
+        int: the number of frames sent again
+    """
+    packets = list(PacketIterator(data, block_size))
+    pending = deque(range(len(packets)))
+    sent = []  # index of each frame sent, in order
+    resends = [0] * len(packets)
+    in_flight = 0
+    acked = 0
+
+    while acked < len(packets):
+        # Fill the window, then wait for a credit
+        if pending and in_flight < window:
+            index = pending.popleft()
+            log.debug(f"Sending frame {index} ({len(packets[index])} bytes)...")
+            sock.sendall(pack_data_frame(index, packets[index], block_size))
+            sent.append(index)
+            in_flight += 1
+            continue
+
+        resp = recv_exact(sock, 1)
+        in_flight -= 1
+        if resp == RESP_OK:
+            acked += 1
+        elif resp == RESP_BAD:
+            # The number is 16 bits, and the bad frame is one of the last few sent
+            (num,) = DATA_INDEX.unpack(recv_exact(sock, DATA_INDEX.size))
+            index = sent[len(sent) - 1 - ((len(sent) - 1 - num) & 0xFFFF)]
+            resends[index] += 1
+            if resends[index] > MAX_RESENDS:
+                exit(f"ERROR: Frame {index} failed its CRC {resends[index]} times")
+            log.warning(f"Frame {index} failed its CRC, sending it again")
+            pending.appendleft(index)
+        else:
             exit(f"ERROR: Bootloader responded with {repr(resp)}")
+
+    if sum(resends):
+        log.info(f"Sent {sum(resends)} of {len(packets)} frames again")
+    return sum(resends)
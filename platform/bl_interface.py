@@ -16,12 +16,17 @@ import os
 import logging
 import socket
 import select
+import selectors
+import time
 from pathlib import Path
 from typing import List, Optional, TypeVar
 
 Message = TypeVar("Message")
 LOG_FORMAT = "%(asctime)s:%(name)-s%(levelname)-8s %(message)s"
 
+# Receive buffer of each direction of the event-driven bridge
+BRIDGE_BUF_SIZE = 65536
+
 
 class Sock:
     def __init__(
@@ -35,6 +40,7 @@ class Sock:
         self.sock_path = sock_path
         self.network = network
         self.buf = b""
+        self.out = b""
 
         # set up socket
         if self.network:
@@ -77,6 +83,11 @@ class Sock:
         ready, _, _ = select.select([sock], [], [], 0)
         return bool(ready)
 
+    @staticmethod
+    def sock_writable(sock: socket.SocketType) -> bool:
+        _, ready, _ = select.select([], [sock], [], 0)
+        return bool(ready)
+
     def active(self) -> bool:
         # try to accept new client
         if not self.csock:
@@ -123,26 +134,47 @@ class Sock:
     def serialize(msg: bytes) -> bytes:
         return msg
 
-    def send_msg(self, msg: Message) -> bool:
+    def pending(self) -> bool:
+        # data accepted by send_msg that the peer has not taken yet
+        return bool(self.out)
+
+    def flush(self) -> bool:
         if not self.active():
             return False
 
         try:
-            self.csock.sendall(self.serialize(msg))
+            # only send what the peer can take right now, never block the relay
+            if self.out and self.sock_writable(self.csock):
+                sent = self.csock.send(self.out)
+                self.out = self.out[sent:]
             return True
         except (ConnectionResetError, BrokenPipeError):
             # cleanly handle forced closed connection
             self.close()
             return False
 
+    def send_msg(self, msg: Message) -> bool:
+        if not self.active():
+            return False
+
+        self.out += self.serialize(msg)
+        return self.flush()
+
     def close(self):
         self.logger.warning(f"Conection closed on {self.sock_path}")
         self.csock = None
         self.buf = b""
+        self.out = b""
 
 
 def poll_data_socks(device_sock: Sock, host_sock: Sock):
-    if device_sock.active():
+    # Each direction only reads more once the other end has taken everything it was given.
+    # A slow reader (the emulated UART, while flash is busy) holds back its writer the way
+    # hardware flow control would, instead of blocking the relay in both directions.
+    device_sock.flush()
+    host_sock.flush()
+
+    if device_sock.active() and not host_sock.pending():
         msg = device_sock.read_msg()
 
         # send message to host
@@ -150,7 +182,7 @@ def poll_data_socks(device_sock: Sock, host_sock: Sock):
             if msg is not None:
                 host_sock.send_msg(msg)
 
-    if host_sock.active():
+    if host_sock.active() and not device_sock.pending():
         msg = host_sock.read_msg()
 
         # send message to device
@@ -160,6 +192,8 @@ def poll_data_socks(device_sock: Sock, host_sock: Sock):
 
 
 def poll_restart_socks(device_sock: Sock, host_sock: Sock):
+    device_sock.flush()
+
     # First check that device opened a restart port
     if device_sock.active():
         # Send host restart commands to device
@@ -169,6 +203,184 @@ def poll_restart_socks(device_sock: Sock, host_sock: Sock):
                 device_sock.send_msg(msg)
 
 
+class Direction:
+    """One direction of the event-driven bridge.
+
+    Data is received straight into a buffer owned by the direction and sent on from a view of
+    it, so it is never copied. Nothing more is read from the source until the destination has
+    taken all of it, which holds back a fast writer the way hardware flow control would.
+    """
+
+    def __init__(self, name: str, src: Sock, dst: Sock, drop: bool):
+        self.name = name
+        self.src = src
+        self.dst = dst
+        # whether data for a destination that is not connected is thrown away, or left unread
+        self.drop = drop
+        self.buf = bytearray(BRIDGE_BUF_SIZE)
+        self.view = memoryview(self.buf)
+        self.pending = self.view[:0]
+        self.received_at = 0.0
+        self.reset()
+
+    def reset(self):
+        self.bytes = 0
+        self.chunks = 0
+        self.latency = 0.0
+        self.max_latency = 0.0
+
+    def wants_read(self) -> bool:
+        return not self.pending and (self.drop or self.dst.csock is not None)
+
+    def received(self, n: int):
+        if self.dst.csock is None:
+            return
+        self.pending = self.view[:n]
+        self.received_at = time.monotonic()
+
+    def sent(self, n: int):
+        self.pending = self.pending[n:]
+        if not self.pending:
+            # from arriving to the last byte leaving, including any time held back
+            latency = time.monotonic() - self.received_at
+            self.chunks += 1
+            self.latency += latency
+            self.max_latency = max(self.max_latency, latency)
+        self.bytes += n
+
+    def report(self) -> str:
+        avg = self.latency / self.chunks if self.chunks else 0.0
+        return (
+            f"{self.name}: {self.bytes} bytes in {self.chunks} chunks, "
+            f"latency avg {avg * 1000:.3f} ms max {self.max_latency * 1000:.3f} ms"
+        )
+
+
+class Bridge:
+    """Relays between the sockets, sleeping in the selector until one of them is ready.
+
+    Each listening socket is watched while it has no client, each client for reads while a
+    direction it feeds has room, and for writes while a direction into it has data pending.
+    """
+
+    def __init__(self, directions: List[Direction], report_interval: float = 0.0):
+        self.directions = directions
+        self.socks = []
+        for d in directions:
+            for sock in (d.src, d.dst):
+                if sock not in self.socks:
+                    sock.sock.setblocking(False)
+                    self.socks.append(sock)
+        self.report_interval = report_interval
+        self.selector = selectors.DefaultSelector()
+        self.registered = {}  # socket -> events it is registered for
+
+    def watch(self, sock: socket.SocketType, events: int, data):
+        if self.registered.get(sock, 0) == events:
+            return
+        if not events:
+            self.selector.unregister(sock)
+            del self.registered[sock]
+        elif sock in self.registered:
+            self.selector.modify(sock, events, data)
+            self.registered[sock] = events
+        else:
+            self.selector.register(sock, events, data)
+            self.registered[sock] = events
+
+    def update(self):
+        for s in self.socks:
+            self.watch(s.sock, selectors.EVENT_READ if s.csock is None else 0, s)
+            if s.csock is None:
+                continue
+            events = 0
+            if any(d.src is s and d.wants_read() for d in self.directions):
+                events |= selectors.EVENT_READ
+            if any(d.dst is s and d.pending for d in self.directions):
+                events |= selectors.EVENT_WRITE
+            self.watch(s.csock, events, s)
+
+    def close(self, s: Sock):
+        if s.csock is None:
+            return
+        self.watch(s.csock, 0, s)
+        s.csock.close()
+        s.close()
+        for d in self.directions:
+            if d.dst is s:
+                d.pending = d.view[:0]
+        if s.network:
+            self.report(s)
+
+    def report(self, s: Sock):
+        for d in self.directions:
+            if s in (d.src, d.dst):
+                s.logger.info(d.report())
+                d.reset()
+
+    def send(self, d: Direction):
+        try:
+            d.sent(d.dst.csock.send(d.pending))
+        except BlockingIOError:
+            pass
+        except (ConnectionResetError, BrokenPipeError):
+            self.close(d.dst)
+
+    def accept(self, s: Sock):
+        try:
+            s.csock, _ = s.sock.accept()
+        except BlockingIOError:
+            return
+        s.csock.setblocking(False)
+        s.logger.info(f"Connection opened on {s.sock_path}")
+
+    def readable(self, s: Sock):
+        for d in self.directions:
+            if d.src is not s or not d.wants_read():
+                continue
+            try:
+                n = s.csock.recv_into(d.view)
+            except BlockingIOError:
+                return
+            except (ConnectionResetError, BrokenPipeError):
+                n = 0
+            if n == 0:
+                self.close(s)
+                return
+            d.received(n)
+            # most of the time the other end can take it straight away
+            if d.pending:
+                self.send(d)
+
+    def writable(self, s: Sock):
+        for d in self.directions:
+            if d.dst is s and d.pending and s.csock is not None:
+                self.send(d)
+
+    def run(self):
+        last_report = time.monotonic()
+        while True:
+            self.update()
+            timeout = self.report_interval or None
+            for key, events in self.selector.select(timeout):
+                s = key.data
+                if key.fileobj is s.sock:
+                    self.accept(s)
+                    continue
+                if events & selectors.EVENT_WRITE and key.fileobj is s.csock:
+                    self.writable(s)
+                # either may have been closed by now, handling this or an earlier event
+                if events & selectors.EVENT_READ and key.fileobj is s.csock:
+                    self.readable(s)
+
+            if self.report_interval and time.monotonic() - last_report >= self.report_interval:
+                last_report = time.monotonic()
+                for d in self.directions:
+                    if d.bytes:
+                        d.src.logger.info(d.report())
+                        d.reset()
+
+
 def parse_args():
     parser = argparse.ArgumentParser()
     parser.add_argument(
@@ -195,6 +407,17 @@ def parse_args():
         required=True,
         help="Path to device-side data socket (will be created)",
     )
+    parser.add_argument(
+        "--poll",
+        action="store_true",
+        help="Use the old polling loop instead of the event-driven bridge",
+    )
+    parser.add_argument(
+        "--report-interval",
+        type=float,
+        default=0.0,
+        help="Also log the byte and latency counters this often, in seconds",
+    )
     return parser.parse_args()
 
 
@@ -208,10 +431,22 @@ def main():
     restart_bl = Sock(str(args.restart_bl_sock), mode=0o777)
     restart_host = Sock(str(args.restart_host_sock), mode=0o777)
 
-    # poll sockets forever
-    while True:
-        poll_data_socks(data_bl, data_host)
-        poll_restart_socks(restart_bl, restart_host)
+    if args.poll:
+        # poll sockets forever
+        while True:
+            poll_data_socks(data_bl, data_host)
+            poll_restart_socks(restart_bl, restart_host)
+
+    # Restart commands wait for the device, data for a missing end is thrown away as above
+    bridge = Bridge(
+        [
+            Direction("to host", data_bl, data_host, drop=True),
+            Direction("to device", data_host, data_bl, drop=True),
+            Direction("restart", restart_host, restart_bl, drop=False),
+        ],
+        args.report_interval,
+    )
+    bridge.run()
 
 
 if __name__ == "__main__":
@@ -13,10 +13,14 @@
 
 import time
 import argparse
+import base64
+import json
 import logging
 import os
 from pathlib import Path
+import socket
 import subprocess
+import sys
 
 import load_image
 import serial_socket_bridge
@@ -26,6 +30,9 @@ logging.basicConfig(
 )
 log = logging.getLogger(Path(__file__).name)
 
+# Seconds to wait for a new session to take requests
+SESSION_START_TIMEOUT = 30
+
 
 def make_dirs(dir_list):
     for path in dir_list:
@@ -136,6 +143,10 @@ def build_system(args):
         f"{args.sysname}/host_tools",
         "--build-arg",
         f"OLDEST_VERSION={args.oldest_allowed_version}",
+        "--build-arg",
+        f"BL_VARIANT={args.bl_variant}",
+        "--build-arg",
+        f"DRIVERLIB_ROM={0 if args.emulated else 1}",
     ]
     subprocess.run(cmd)
 
@@ -310,7 +321,9 @@ def launch_emulator(args, interactive=False, do_gdb=False):
 
 def launch_bootloader_bridge(args):
     # Launch bridge (takes up terminal)
-    serial_socket_bridge.bridge(args.uart_sock, args.serial_port)
+    serial_socket_bridge.bridge(
+        args.uart_sock, args.serial_port, baudrate=args.baudrate
+    )
 
 
 def launch_bootloader(args):
@@ -347,6 +360,18 @@ def launch_bootloader_interactive(args):
 
 
 def fw_protect(args):
+    if args.session:
+        session_request(
+            args,
+            "fw-protect",
+            firmware=args.raw_fw_file,
+            version=args.fw_version,
+            release_message=args.fw_message,
+            output_file=args.protected_fw_file,
+            json=args.json,
+        )
+        return
+
     # Get Docker-managed volumes
     secrets_root = get_volume(args.sysname, "secrets")
 
@@ -374,10 +399,21 @@ def fw_protect(args):
         "--output-file",
         f"{args.protected_fw_file}",
     ]
+    if args.json:
+        cmd.append("--json")
     subprocess.run(cmd)
 
 
 def cfg_protect(args):
+    if args.session:
+        session_request(
+            args,
+            "cfg-protect",
+            input_file=args.raw_cfg_file,
+            output_file=args.protected_cfg_file,
+        )
+        return
+
     # Get Docker-managed volumes
     secrets_root = get_volume(args.sysname, "secrets")
 
@@ -403,7 +439,46 @@ def cfg_protect(args):
     subprocess.run(cmd)
 
 
+def protect_batch(args):
+    # Get Docker-managed volumes
+    secrets_root = get_volume(args.sysname, "secrets")
+
+    # Need abspath for local folders to mount as Docker volumes
+    fw_root = os.path.abspath(args.fw_root)
+    cfg_root = os.path.abspath(args.cfg_root)
+    make_dirs([fw_root, cfg_root])
+
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "-v",
+        f"{secrets_root}:/secrets",
+        "-v",
+        f"{fw_root}:/firmware",
+        "-v",
+        f"{cfg_root}:/configuration",
+        f"{args.sysname}/host_tools",
+        "/host_tools/protect_batch",
+        "--manifest",
+        f"{args.manifest}",
+    ]
+    if args.jobs is not None:
+        cmd += ["--jobs", f"{args.jobs}"]
+    if args.no_cache:
+        cmd += ["--no-cache"]
+    subprocess.run(cmd)
+
+
 def fw_update(args):
+    if args.session:
+        session_request(
+            args, "fw-update", socket=args.uart_sock, firmware_file=args.protected_fw_file
+        )
+        if args.stats:
+            stats(args)
+        return
+
     # Need abspath for local folder to mount as a Docker volume
     fw_root = os.path.abspath(args.fw_root)
 
@@ -427,8 +502,19 @@ def fw_update(args):
     ]
     subprocess.run(cmd)
 
+    if args.stats:
+        stats(args)
+
 
 def cfg_load(args):
+    if args.session:
+        session_request(
+            args, "cfg-load", socket=args.uart_sock, config_file=args.protected_cfg_file
+        )
+        if args.stats:
+            stats(args)
+        return
+
     # Need abspath for local folder to mount as a Docker volume
     cfg_root = os.path.abspath(args.cfg_root)
 
@@ -452,8 +538,27 @@ def cfg_load(args):
     ]
     subprocess.run(cmd)
 
+    if args.stats:
+        stats(args)
+
 
 def readback(args, rb_region):
+    if args.session:
+        session_request(
+            args,
+            "readback",
+            socket=args.uart_sock,
+            region=rb_region,
+            num_bytes=args.rb_len,
+            offset=args.rb_offset,
+            page_size=args.rb_page_size,
+            rle=args.rb_rle,
+            format=args.rb_format,
+        )
+        if args.stats:
+            stats(args)
+        return
+
     # Get Docker-managed volumes
     secrets_root = get_volume(args.sysname, "secrets")
 
@@ -474,8 +579,19 @@ def readback(args, rb_region):
         "--num-bytes",
         f"{args.rb_len}",
     ]
+    if args.rb_offset is not None:
+        cmd += ["--offset", f"{args.rb_offset}"]
+    if args.rb_page_size is not None:
+        cmd += ["--page-size", f"{args.rb_page_size}"]
+    if args.rb_rle:
+        cmd += ["--rle"]
+    if args.rb_format is not None:
+        cmd += ["--format", f"{args.rb_format}"]
     subprocess.run(cmd)
 
+    if args.stats:
+        stats(args)
+
 
 def fw_readback(args):
     readback(args, rb_region="firmware")
@@ -486,6 +602,12 @@ def cfg_readback(args):
 
 
 def boot(args):
+    if args.session:
+        session_request(
+            args, "boot", socket=args.uart_sock, release_message_file=args.boot_msg_file
+        )
+        return
+
     # Get Docker-managed volumes
     msg_root = get_volume(args.sysname, "messages")
 
@@ -508,6 +630,140 @@ def boot(args):
     subprocess.run(cmd)
 
 
+def batch(args):
+    # Need abspath for local folders to mount as Docker volumes
+    fw_root = os.path.abspath(args.fw_root)
+    cfg_root = os.path.abspath(args.cfg_root)
+    msg_root = get_volume(args.sysname, "messages")
+
+    make_dirs([fw_root, cfg_root])
+
+    tool_args = f"--socket {args.uart_sock} "
+    if args.protected_cfg_file:
+        tool_args += f"--config-file {args.protected_cfg_file} "
+    if args.protected_fw_file:
+        tool_args += f"--firmware-file {args.protected_fw_file} "
+    if args.boot_msg_file:
+        tool_args += f"--release-message-file {args.boot_msg_file} "
+
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "--add-host",
+        "saffire-net:host-gateway",
+        "-v",
+        f"{fw_root}:/firmware",
+        "-v",
+        f"{cfg_root}:/configuration",
+        "-v",
+        f"{msg_root}:/messages",
+        f"{args.sysname}/host_tools",
+        "/bin/bash",
+        "-c",
+        f"rm -rf /secrets; "
+        f"/host_tools/batch {tool_args}",
+    ]
+    subprocess.run(cmd)
+
+
+def provision(args):
+    # Need abspath for local folders to mount as Docker volumes
+    fw_root = os.path.abspath(args.fw_root)
+    cfg_root = os.path.abspath(args.cfg_root)
+    secrets_root = get_volume(args.sysname, "secrets")
+    msg_root = get_volume(args.sysname, "messages")
+
+    make_dirs([fw_root, cfg_root])
+
+    tool_args = "".join(f"--socket {sock} " for sock in args.uart_sock)
+    if args.protected_cfg_file:
+        tool_args += f"--config-file {args.protected_cfg_file} "
+    if args.protected_fw_file:
+        tool_args += f"--firmware-file {args.protected_fw_file} "
+    if args.verify:
+        tool_args += f"--verify {args.verify} "
+    if args.boot_msg_file:
+        tool_args += f"--release-message-file {args.boot_msg_file} "
+    if args.jobs:
+        tool_args += f"--jobs {args.jobs} "
+    if args.timeout:
+        tool_args += f"--timeout {args.timeout} "
+
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "--add-host",
+        "saffire-net:host-gateway",
+        "-v",
+        f"{fw_root}:/firmware",
+        "-v",
+        f"{cfg_root}:/configuration",
+        "-v",
+        f"{msg_root}:/messages",
+    ]
+    if args.verify:
+        # Checking the installed images needs the readback password and the key
+        cmd += [
+            "-v",
+            f"{secrets_root}:/secrets",
+            f"{args.sysname}/host_tools",
+            "/bin/bash",
+            "-c",
+            f"/host_tools/provision {tool_args}",
+        ]
+    else:
+        cmd += [
+            f"{args.sysname}/host_tools",
+            "/bin/bash",
+            "-c",
+            f"rm -rf /secrets; /host_tools/provision {tool_args}",
+        ]
+    subprocess.run(cmd)
+
+
+def verify(args):
+    if args.session:
+        session_request(
+            args,
+            "verify",
+            socket=args.uart_sock,
+            region=args.region,
+            package=args.package_file,
+            algorithm=args.algorithm,
+        )
+        return
+
+    # Need abspath for local folders to mount as Docker volumes
+    package_root = os.path.abspath(args.package_root)
+    secrets_root = get_volume(args.sysname, "secrets")
+    mount = "/firmware" if args.region == "firmware" else "/configuration"
+
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "--add-host",
+        "saffire-net:host-gateway",
+        "-v",
+        f"{secrets_root}:/secrets",
+        "-v",
+        f"{package_root}:{mount}",
+        f"{args.sysname}/host_tools",
+        "/host_tools/verify",
+        "--socket",
+        f"{args.uart_sock}",
+        "--region",
+        f"{args.region}",
+        "--package",
+        f"{args.package_file}",
+        "--algorithm",
+        f"{args.algorithm}",
+    ]
+    subprocess.run(cmd)
+
+
 def monitor(args):
     # Get Docker-managed volumes
     msg_root = get_volume(args.sysname, "messages")
@@ -531,6 +787,130 @@ def monitor(args):
     subprocess.run(cmd)
 
 
+def stats(args):
+    if args.session:
+        session_request(args, "stats", socket=args.uart_sock)
+        return
+
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "--add-host",
+        "saffire-net:host-gateway",
+        f"{args.sysname}/host_tools",
+        "/bin/bash",
+        "-c",
+        f"rm -rf /secrets ; "
+        f"/host_tools/stats "
+        f"--socket {args.uart_sock}",
+    ]
+    subprocess.run(cmd)
+
+
+def trace(args):
+    cmd = [
+        "docker",
+        "run",
+        "-i",
+        "--add-host",
+        "saffire-net:host-gateway",
+        f"{args.sysname}/host_tools",
+        "/bin/bash",
+        "-c",
+        f"rm -rf /secrets ; "
+        f"/host_tools/trace "
+        f"--socket {args.uart_sock}",
+    ]
+    subprocess.run(cmd)
+
+
+def session_request(args, op, **op_args):
+    """Run an operation in the session on port args.session instead of in a new container
+
+    The session's log lines are printed as they arrive, and what the operation prints is written
+    to stdout as it arrives.
+    """
+    with socket.create_connection(("localhost", int(args.session))) as sock:
+        sock.sendall(json.dumps({"op": op, "args": op_args}).encode() + b"\n")
+        for line in sock.makefile("rb"):
+            msg = json.loads(line)
+            if "log" in msg:
+                print(msg["log"], file=sys.stderr)
+                continue
+            if "stdout" in msg:
+                sys.stdout.buffer.write(base64.b64decode(msg["stdout"]))
+                sys.stdout.flush()
+                continue
+
+            if msg["status"] != 0:
+                exit(msg["error"])
+            return
+    raise ConnectionError("session closed the connection without an answer")
+
+
+def session_start(args):
+    # Need abspath for local folders to mount as Docker volumes
+    fw_root = os.path.abspath(args.fw_root)
+    cfg_root = os.path.abspath(args.cfg_root)
+    make_dirs([fw_root, cfg_root])
+
+    # Get Docker-managed volumes
+    secrets_root = get_volume(args.sysname, "secrets")
+    msg_root = get_volume(args.sysname, "messages")
+
+    cmd = [
+        "docker",
+        "run",
+        "-d",
+        "--add-host",
+        "saffire-net:host-gateway",
+        "-p",
+        f"127.0.0.1:{args.session}:{args.session}",
+        "-v",
+        f"{fw_root}:/firmware",
+        "-v",
+        f"{cfg_root}:/configuration",
+        "-v",
+        f"{msg_root}:/messages",
+    ]
+    if args.with_secrets:
+        cmd += [
+            "-v",
+            f"{secrets_root}:/secrets",
+            f"{args.sysname}/host_tools",
+            "/host_tools/session",
+            "--port",
+            f"{args.session}",
+        ]
+    else:
+        # Like the update, load and boot tools, it gets no secrets
+        cmd += [
+            f"{args.sysname}/host_tools",
+            "/bin/bash",
+            "-c",
+            f"rm -rf /secrets; /host_tools/session --port {args.session}",
+        ]
+    subprocess.run(cmd)
+
+    # Wait for it to take requests
+    deadline = time.monotonic() + SESSION_START_TIMEOUT
+    while True:
+        try:
+            session_request(args, "ping")
+            break
+        except OSError:
+            if time.monotonic() > deadline:
+                exit(f"ERROR: Session on {args.session} did not start")
+            time.sleep(0.5)
+    log.info(f"Session taking requests on {args.session}")
+
+
+def session_stop(args):
+    session_request(args, "stop")
+    log.info(f"Session on {args.session} stopped")
+
+
 def cleanup(args):
     f_path = Path(f"{args.sysname}-bootloader.elf.deleteme")
     if f_path.exists():
@@ -564,6 +944,12 @@ def get_args():
         required=True,
         help="Oldest allowed firmware version on device",
     )
+    parser_create.add_argument(
+        "--bl-variant",
+        default="release-size",
+        choices=["debug", "release-size", "release-speed"],
+        help="Bootloader build variant",
+    )
     create_group = parser_create.add_mutually_exclusive_group(required=True)
     create_group.add_argument(
         "--physical",
@@ -604,6 +990,12 @@ def get_args():
     parser_bl.add_argument("--sock-root", help="Directory to place sockets")
     parser_bl.add_argument("--uart-sock", required=True, help="UART interface socket")
     parser_bl.add_argument("--serial-port", help="Physical device serial port")
+    parser_bl.add_argument(
+        "--baudrate",
+        type=int,
+        default=115200,
+        help="Physical device serial baud rate",
+    )
     bl_group = parser_bl.add_mutually_exclusive_group(required=True)
     bl_group.add_argument(
         "--physical",
@@ -655,12 +1047,18 @@ def get_args():
     parser_fw_protect.add_argument(
         "--protected-fw-file", required=True, help="Firmware protect output file"
     )
+    parser_fw_protect.add_argument(
+        "--json", action="store_true", help="Write the old hex-in-JSON format"
+    )
     parser_fw_protect.add_argument(
         "--fw-version", required=True, help="Firmware protect version"
     )
     parser_fw_protect.add_argument(
         "--fw-message", required=True, help="Firmware protect release message"
     )
+    parser_fw_protect.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_fw_protect.set_defaults(func=fw_protect)
 
     # Configuration protect
@@ -679,8 +1077,33 @@ def get_args():
     parser_cfg_protect.add_argument(
         "--protected-cfg-file", required=True, help="Configuration protect output file"
     )
+    parser_cfg_protect.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_cfg_protect.set_defaults(func=cfg_protect)
 
+    # Protect a manifest of images at once
+    parser_protect_batch = subparsers.add_parser("protect-batch", help="protect-batch help")
+    parser_protect_batch.add_argument(
+        "--sysname", required=True, help="SAFFIRe system name"
+    )
+    parser_protect_batch.add_argument(
+        "--fw-root", required=True, help="Directory of the manifest and firmware images"
+    )
+    parser_protect_batch.add_argument(
+        "--cfg-root", required=True, help="Directory of the configuration images"
+    )
+    parser_protect_batch.add_argument(
+        "--manifest", required=True, help="Manifest of the images to protect, in --fw-root"
+    )
+    parser_protect_batch.add_argument(
+        "--jobs", help="Images to protect at once, by default one per core"
+    )
+    parser_protect_batch.add_argument(
+        "--no-cache", action="store_true", help="Protect everything again"
+    )
+    parser_protect_batch.set_defaults(func=protect_batch)
+
     # Firmware update
     parser_fw_update = subparsers.add_parser("fw-update", help="fw-update help")
     parser_fw_update.add_argument(
@@ -695,6 +1118,12 @@ def get_args():
     parser_fw_update.add_argument(
         "--protected-fw-file", required=True, help="Firmware update input file"
     )
+    parser_fw_update.add_argument(
+        "--stats", action="store_true", help="Print profiling stats afterwards"
+    )
+    parser_fw_update.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_fw_update.set_defaults(func=fw_update)
 
     # Load configuration
@@ -709,6 +1138,12 @@ def get_args():
     parser_cfg_load.add_argument(
         "--protected-cfg-file", required=True, help="Configuration load input file"
     )
+    parser_cfg_load.add_argument(
+        "--stats", action="store_true", help="Print profiling stats afterwards"
+    )
+    parser_cfg_load.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_cfg_load.set_defaults(func=cfg_load)
 
     # Firmware readback
@@ -722,6 +1157,26 @@ def get_args():
     parser_fw_readback.add_argument(
         "--rb-len", required=True, help="Readback request data length"
     )
+    parser_fw_readback.add_argument(
+        "--rb-offset", help="Readback offset within the region"
+    )
+    parser_fw_readback.add_argument(
+        "--rb-page-size", help="Read back this many bytes at a time"
+    )
+    parser_fw_readback.add_argument(
+        "--rb-rle", action="store_true", help="Run-length encode the readback"
+    )
+    parser_fw_readback.add_argument(
+        "--rb-format",
+        choices=["hex", "bin", "sha256", "crc32"],
+        help="Readback output format",
+    )
+    parser_fw_readback.add_argument(
+        "--stats", action="store_true", help="Print profiling stats afterwards"
+    )
+    parser_fw_readback.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_fw_readback.set_defaults(func=fw_readback)
 
     # Configuration readback
@@ -737,6 +1192,26 @@ def get_args():
     parser_cfg_readback.add_argument(
         "--rb-len", required=True, help="Readback request data length"
     )
+    parser_cfg_readback.add_argument(
+        "--rb-offset", help="Readback offset within the region"
+    )
+    parser_cfg_readback.add_argument(
+        "--rb-page-size", help="Read back this many bytes at a time"
+    )
+    parser_cfg_readback.add_argument(
+        "--rb-rle", action="store_true", help="Run-length encode the readback"
+    )
+    parser_cfg_readback.add_argument(
+        "--rb-format",
+        choices=["hex", "bin", "sha256", "crc32"],
+        help="Readback output format",
+    )
+    parser_cfg_readback.add_argument(
+        "--stats", action="store_true", help="Print profiling stats afterwards"
+    )
+    parser_cfg_readback.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_cfg_readback.set_defaults(func=cfg_readback)
 
     # Device boot
@@ -748,8 +1223,92 @@ def get_args():
         required=True,
         help="File path for host to store booted release message in",
     )
+    parser_boot.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
     parser_boot.set_defaults(func=boot)
 
+    # Configure, update and boot in one batch
+    parser_batch = subparsers.add_parser("batch", help="batch help")
+    parser_batch.add_argument("--sysname", required=True, help="SAFFIRe system name")
+    parser_batch.add_argument("--uart-sock", required=True, help="UART interface socket")
+    parser_batch.add_argument(
+        "--cfg-root", default=".", help="Directory to read configuration images"
+    )
+    parser_batch.add_argument(
+        "--protected-cfg-file", help="Configuration load input file"
+    )
+    parser_batch.add_argument(
+        "--fw-root", default=".", help="Directory to read firmware images"
+    )
+    parser_batch.add_argument(
+        "--protected-fw-file", help="Firmware update input file"
+    )
+    parser_batch.add_argument(
+        "--boot-msg-file",
+        help="Boot afterwards, storing the booted release message in this file",
+    )
+    parser_batch.set_defaults(func=batch)
+
+    # Provision many devices at once
+    parser_provision = subparsers.add_parser("provision", help="provision help")
+    parser_provision.add_argument("--sysname", required=True, help="SAFFIRe system name")
+    parser_provision.add_argument(
+        "--uart-sock",
+        required=True,
+        action="append",
+        help="UART interface socket of a device, once for each device",
+    )
+    parser_provision.add_argument(
+        "--cfg-root", default=".", help="Directory to read configuration images"
+    )
+    parser_provision.add_argument(
+        "--protected-cfg-file", help="Configuration load input file"
+    )
+    parser_provision.add_argument(
+        "--fw-root", default=".", help="Directory to read firmware images"
+    )
+    parser_provision.add_argument(
+        "--protected-fw-file", help="Firmware update input file"
+    )
+    parser_provision.add_argument(
+        "--verify",
+        choices=["crc32", "sha256"],
+        help="Check the installed images against the packages with this digest",
+    )
+    parser_provision.add_argument(
+        "--boot-msg-file",
+        help="Boot afterwards, storing each release message in this file plus the socket",
+    )
+    parser_provision.add_argument(
+        "--jobs", help="Devices to provision at once, by default all of them"
+    )
+    parser_provision.add_argument(
+        "--timeout", help="Seconds to wait for a device before giving up on it"
+    )
+    parser_provision.set_defaults(func=provision)
+
+    # Installed image check
+    parser_verify = subparsers.add_parser("verify", help="verify help")
+    parser_verify.add_argument("--sysname", required=True, help="SAFFIRe system name")
+    parser_verify.add_argument("--uart-sock", required=True, help="UART interface socket")
+    parser_verify.add_argument(
+        "--region", required=True, choices=["firmware", "configuration"], help="Region to check"
+    )
+    parser_verify.add_argument(
+        "--package-root", default=".", help="Directory to read the protected package from"
+    )
+    parser_verify.add_argument(
+        "--package-file", required=True, help="Protected package to compare with"
+    )
+    parser_verify.add_argument(
+        "--algorithm", default="sha256", choices=["crc32", "sha256"], help="Digest to compare"
+    )
+    parser_verify.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
+    parser_verify.set_defaults(func=verify)
+
     # Firmware monitor
     parser_monitor = subparsers.add_parser("monitor", help="monitor help")
     parser_monitor.add_argument("--sysname", required=True, help="SAFFIRe system name")
@@ -763,6 +1322,48 @@ def get_args():
     )
     parser_monitor.set_defaults(func=monitor)
 
+    # Bootloader profiling stats
+    parser_stats = subparsers.add_parser("stats", help="stats help")
+    parser_stats.add_argument("--sysname", required=True, help="SAFFIRe system name")
+    parser_stats.add_argument("--uart-sock", required=True, help="UART interface socket")
+    parser_stats.add_argument(
+        "--session", help="Run in the session on this port instead of a new container"
+    )
+    parser_stats.set_defaults(func=stats)
+
+    # Bootloader diagnostics trace
+    parser_trace = subparsers.add_parser("trace", help="trace help")
+    parser_trace.add_argument("--sysname", required=True, help="SAFFIRe system name")
+    parser_trace.add_argument("--uart-sock", required=True, help="UART interface socket")
+    parser_trace.set_defaults(func=trace)
+
+    # Long-lived host tools session
+    parser_session_start = subparsers.add_parser("session-start", help="session-start help")
+    parser_session_start.add_argument(
+        "--sysname", required=True, help="SAFFIRe system name"
+    )
+    parser_session_start.add_argument(
+        "--session", required=True, help="Port for the session to take requests on"
+    )
+    parser_session_start.add_argument(
+        "--fw-root", default=".", help="Directory to read and save firmware images"
+    )
+    parser_session_start.add_argument(
+        "--cfg-root", default=".", help="Directory to read and save configuration images"
+    )
+    parser_session_start.add_argument(
+        "--with-secrets",
+        action="store_true",
+        help="Give the session the secrets, for protect, readback and verify",
+    )
+    parser_session_start.set_defaults(func=session_start)
+
+    parser_session_stop = subparsers.add_parser("session-stop", help="session-stop help")
+    parser_session_stop.add_argument(
+        "--session", required=True, help="Port the session takes requests on"
+    )
+    parser_session_stop.set_defaults(func=session_stop)
+
     # Clean up temporary files
     parser_cleanup = subparsers.add_parser("cleanup", help="cleanup help")
     parser_cleanup.add_argument("--sysname", required=True, help="SAFFIRe system name")
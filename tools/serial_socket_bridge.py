@@ -14,62 +14,99 @@
 import argparse
 import logging
 import socket
-import select
 import serial
+import threading
+import time
 from typing import Optional
 
+# Largest read from the host socket
+SOCK_BUF_SIZE = 65536
+
+# Seconds between tries to open the serial port while the device is not there
+RECONNECT_DELAY = 0.5
+
 
 class Port:
-    def __init__(self, device_port: str, baudrate=115200, log_level=logging.INFO):
+    def __init__(
+        self, device_port: str, baudrate=115200, rtscts=False, log_level=logging.INFO
+    ):
         self.device_port = device_port
         self.baudrate = baudrate
+        self.rtscts = rtscts
         self.ser = None
 
+        # Both directions open the port, only one of them may
+        self.lock = threading.Lock()
+
         # Set up logger
         self.logger = logging.getLogger(f"{device_port}_log")
-        self.logger.info(f"Ready to connect to device on serial {self.device_port}")
+        self.logger.info(
+            f"Ready to connect to device on serial {self.device_port} at {self.baudrate} baud"
+        )
 
-    def active(self) -> bool:
+    def open(self) -> Optional[serial.Serial]:
         # If not connected, try to connect to serial device
-        if not self.ser:
-            try:
-                ser = serial.Serial(
-                    self.device_port, baudrate=self.baudrate, timeout=0.1
-                )
-                ser.reset_input_buffer()
-                self.ser = ser
-                self.logger.info(f"Connection opened on {self.device_port}")
-            except (serial.SerialException, OSError):
-                pass
-        return bool(self.ser)
+        with self.lock:
+            if not self.ser:
+                try:
+                    ser = serial.Serial(
+                        self.device_port,
+                        baudrate=self.baudrate,
+                        rtscts=self.rtscts,
+                        timeout=0.1,
+                    )
+                    ser.reset_input_buffer()
+                    self.ser = ser
+                    self.logger.info(f"Connection opened on {self.device_port}")
+                except (serial.SerialException, OSError):
+                    pass
+            # The other direction may close it once the lock is released, so each caller keeps
+            # using the instance it was given
+            return self.ser
+
+    def active(self) -> bool:
+        return self.open() is not None
 
     def read_msg(self) -> Optional[bytes]:
-        if not self.active():
+        ser = self.open()
+        if ser is None:
             return None
 
         try:
-            msg = self.ser.read()
+            # Everything that has arrived, or wait up to the timeout for the next byte
+            msg = ser.read(ser.in_waiting or 1)
             if msg != b"":
                 return msg
             return None
-        except (serial.SerialException, OSError):
-            self.close()
+        except (serial.SerialException, OSError, TypeError):
+            # pyserial raises TypeError when the port goes away mid-read
+            self.close(ser)
             return None
 
     def send_msg(self, msg: bytes) -> bool:
-        if not self.active():
+        ser = self.open()
+        if ser is None:
             return False
 
         try:
-            self.ser.write(msg)
+            ser.write(msg)
             return True
-        except (serial.SerialException, OSError):
-            self.close()
+        except (serial.SerialException, OSError, TypeError):
+            # As in read_msg()
+            self.close(ser)
             return False
 
-    def close(self):
-        self.logger.warning(f"Connection closed on {self.device_port}")
-        self.ser = None
+    def close(self, ser: serial.Serial):
+        # Either direction may notice first
+        with self.lock:
+            if self.ser is not ser:
+                return
+            self.logger.warning(f"Connection closed on {self.device_port}")
+            try:
+                ser.close()
+            except (serial.SerialException, OSError):
+                pass
+            self.ser = None
 
 
 class Sock:
@@ -87,83 +124,131 @@ class Sock:
         self.logger = logging.getLogger(f"{sock_port}_log")
         self.logger.info(f"Ready to connect to socket on port {self.sock_port}")
 
-    @staticmethod
-    def sock_ready(sock: socket.SocketType) -> bool:
-        ready, _, _ = select.select([sock], [], [], 0)
-        return bool(ready)
-
-    def active(self) -> bool:
-        # Try to accept new client
-        if not self.csock:
-            if self.sock_ready(self.sock):
-                self.logger.info(f"Connection opened on {self.sock_port}")
-                self.csock, _ = self.sock.accept()
-        return bool(self.csock)
+    def accept(self):
+        # Wait for a client
+        self.csock, _ = self.sock.accept()
+        self.logger.info(f"Connection opened on {self.sock_port}")
 
     def read_msg(self) -> Optional[bytes]:
-        if not self.active():
+        csock = self.csock
+        if csock is None:
             return None
 
         try:
-            if self.sock_ready(self.csock):
-                data = self.csock.recv(4096)
-
-                # Connection closed
-                if not data:
-                    self.close()
-                    return None
-
-                return data
-            return None
-        except (ConnectionResetError, BrokenPipeError):
+            data = csock.recv(SOCK_BUF_SIZE)
+        except OSError:
             # Cleanly handle forced closed connection
-            self.close()
+            data = b""
+
+        # Connection closed
+        if not data:
+            self.close(csock)
             return None
+        return data
 
     def send_msg(self, msg: bytes) -> bool:
-        if not self.active():
+        csock = self.csock
+        if csock is None:
             return False
 
         try:
-            self.csock.sendall(msg)
+            csock.sendall(msg)
             return True
-        except (ConnectionResetError, BrokenPipeError):
+        except OSError:
             # Cleanly handle forced closed connection
-            self.close()
+            self.close(csock)
             return False
 
-    def close(self):
+    def close(self, csock: socket.socket):
+        # Either direction may notice first
+        if self.csock is not csock:
+            return
         self.logger.warning(f"Conection closed on {self.sock_port}")
         self.csock = None
+        # Wake the other direction if it is blocked in recv() on this socket
+        try:
+            csock.shutdown(socket.SHUT_RDWR)
+        except OSError:
+            pass
+        csock.close()
+
+
+class Stats:
+    """Bytes bridged each way, logged every interval there was traffic"""
+
+    def __init__(self, interval: float):
+        self.interval = interval
+        self.counts = {"host->device": 0, "device->host": 0}
+        self.logger = logging.getLogger("bridge_stats")
+
+    def add(self, direction: str, n: int):
+        self.counts[direction] += n
+
+    def run(self):
+        last = dict(self.counts)
+        while True:
+            time.sleep(self.interval)
+            now = dict(self.counts)
+            if now == last:
+                continue
+            lines = []
+            for d in now:
+                n = now[d] - last[d]
+                rate = n / self.interval / 1024
+                lines.append(f"{d}: {n} bytes ({rate:.1f} KB/s), {now[d]} total")
+            self.logger.info(", ".join(lines))
+            last = now
+
+
+def host_to_device(host_sock: Sock, device_port: Port, stats: Stats):
+    while True:
+        if host_sock.csock is None:
+            host_sock.accept()
 
-
-def poll_bridge(host_sock: Sock, device_port: Port):
-    if host_sock.active():
+        # Blocks until the host sends something, or goes away
         msg = host_sock.read_msg()
 
         # Send message to device
-        if device_port.active():
-            if msg is not None:
-                device_port.send_msg(msg)
+        if msg is not None and device_port.active():
+            if device_port.send_msg(msg):
+                stats.add("host->device", len(msg))
+
+
+def device_to_host(host_sock: Sock, device_port: Port, stats: Stats):
+    while True:
+        if not device_port.active():
+            time.sleep(RECONNECT_DELAY)
+            continue
 
-    if device_port.active():
+        # Blocks until the device sends something, for at most the port timeout
         msg = device_port.read_msg()
 
         # Send message to host
-        if host_sock.active():
-            if msg is not None:
-                host_sock.send_msg(msg)
+        if msg is not None and host_sock.csock is not None:
+            if host_sock.send_msg(msg):
+                stats.add("device->host", len(msg))
 
 
-def bridge(uart_sock: int, device_port: str):
+def bridge(
+    uart_sock: int,
+    device_port: str,
+    rtscts: bool = False,
+    baudrate: int = 115200,
+    stats_interval: float = 10.0,
+):
 
     # Open all sockets
     uart_sock_obj = Sock(uart_sock)
-    device_port_obj = Port(device_port)
+    device_port_obj = Port(device_port, baudrate=baudrate, rtscts=rtscts)
+    stats = Stats(stats_interval)
 
-    # poll socket to serial bridge forever
-    while True:
-        poll_bridge(uart_sock_obj, device_port_obj)
+    # One thread for each direction, each blocking until it has something to pass on
+    threading.Thread(
+        target=device_to_host, args=(uart_sock_obj, device_port_obj, stats), daemon=True
+    ).start()
+    if stats_interval > 0:
+        threading.Thread(target=stats.run, daemon=True).start()
+    host_to_device(uart_sock_obj, device_port_obj, stats)
 
 
 # Run in application mode
@@ -181,8 +266,25 @@ if __name__ == "__main__":
         help="Path to host-side data socket (will be created)",
     )
     parser.add_argument("--device-port", required=True, help="Device-side serial port")
+    parser.add_argument(
+        "--rtscts",
+        action="store_true",
+        help="Use RTS/CTS hardware flow control (the link must wire them up)",
+    )
+    parser.add_argument(
+        "--baudrate",
+        type=int,
+        default=115200,
+        help="Serial baud rate, which must match the bootloader's UART",
+    )
+    parser.add_argument(
+        "--stats-interval",
+        type=float,
+        default=10.0,
+        help="Seconds between throughput logs, 0 for none",
+    )
     args = parser.parse_args()
 
     uart_sock, device_port = args.uart_sock, args.device_port
 
-    bridge(uart_sock, device_port)
+    bridge(uart_sock, device_port, args.rtscts, args.baudrate, args.stats_interval)